@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "stack.h"
+#include "allocation.h"
+
+const uint64_t CHURN_ROUNDS = 200000;
+
+const int      CHURN_LIVE   = 64;
+
+const int      CAPACITIES[] = {8, 64, 512, 4096};
+
+static double  BlockChurn     (void* (*alloc)(size_t, size_t), void (*dealloc)(void*), size_t size, uint64_t rounds);
+
+static double  StackChurn     (int capacity, uint64_t rounds);
+
+static double  Now            ();
+
+int main(int argc, const char* argv[])
+{
+    uint64_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : CHURN_ROUNDS;
+
+    printf("alloc/free pairs per run: %lu, %d blocks live\n\n", rounds, CHURN_LIVE);
+
+    printf("%10s %12s %16s %16s %16s\n", "capacity", "block, B", "calloc, Mops/s", "pool, Mops/s", "ctor+dtor, Mops/s");
+
+    for (size_t i = 0; i < sizeof(CAPACITIES) / sizeof(CAPACITIES[0]); i++)
+    {
+        size_t size = 128 + CAPACITIES[i] * sizeof(StackElem_t); // Stack_t + canaries + data
+
+        double libc = BlockChurn(calloc,      free,      size, rounds);
+
+        double pool = BlockChurn(pool_calloc, pool_free, size, rounds);
+
+        double ctor = StackChurn(CAPACITIES[i], rounds);
+
+        printf("%10d %12lu %16.2f %16.2f %16.2f\n", CAPACITIES[i], size, libc / 1e6, pool / 1e6, ctor / 1e6);
+    }
+
+    return err ? 1 : 0;
+}
+
+// Keeps CHURN_LIVE blocks alive and replaces a pseudo-random one each round,
+// which is what a service creating one short-lived stack per request does.
+
+double BlockChurn(void* (*alloc)(size_t, size_t), void (*dealloc)(void*), size_t size, uint64_t rounds)
+{
+    void* live[CHURN_LIVE] = {};
+
+    uint32_t random = 2463534242;
+
+    double start = Now();
+
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+
+        int victim = (int) (random % CHURN_LIVE);
+
+        dealloc(live[victim]);
+
+        live[victim] = alloc(1, size);
+    }
+
+    double elapsed = Now() - start;
+
+    for (int i = 0; i < CHURN_LIVE; i++)
+    {
+        dealloc(live[i]);
+    }
+
+    return (double) rounds / elapsed;
+}
+
+double StackChurn(int capacity, uint64_t rounds)
+{
+    StackId_t live[CHURN_LIVE] = {};
+
+    uint32_t random = 2463534242;
+
+    for (int i = 0; i < CHURN_LIVE; i++)
+    {
+        live[i] = STACK_CTOR(capacity);
+    }
+
+    double start = Now();
+
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+
+        int victim = (int) (random % CHURN_LIVE);
+
+        StackDtor(live[victim]);
+
+        live[victim] = STACK_CTOR(capacity);
+    }
+
+    double elapsed = Now() - start;
+
+    for (int i = 0; i < CHURN_LIVE; i++)
+    {
+        StackDtor(live[i]);
+    }
+
+    return (double) rounds / elapsed;
+}
+
+double Now()
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "stack.h"
+
+const int      BENCH_CAPACITY = 4096;
+
+const uint64_t BENCH_OPS      = 1000000;
+
+struct BenchArgs_t
+{
+    StackId_t id;
+    uint64_t  ops;
+};
+
+static void*  PairWorker     (void* args);
+
+static double RunContention  (StackOptions_t options, int threads, uint64_t ops);
+
+static double Now            ();
+
+int main(int argc, const char* argv[])
+{
+    uint64_t ops = argc > 1 ? strtoull(argv[1], nullptr, 10) : BENCH_OPS;
+
+    long MaxThreads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("push+pop pairs per thread: %lu\n\n", ops);
+
+    printf("%8s %18s %18s %18s %18s\n", "threads", "mutex", "mutex+elim", "lock-free", "lock-free+elim");
+
+    for (int threads = 1; threads <= MaxThreads; threads *= 2)
+    {
+        double locked       = RunContention({STACK_MODE_LOCKED,    false}, threads, ops);
+
+        double LockedElim   = RunContention({STACK_MODE_LOCKED,    true},  threads, ops);
+
+        double LockFree     = RunContention({STACK_MODE_LOCK_FREE, false}, threads, ops);
+
+        double LockFreeElim = RunContention({STACK_MODE_LOCK_FREE, true},  threads, ops);
+
+        printf("%8d %18.2f %18.2f %18.2f %18.2f\n", threads,
+               locked / 1e6, LockedElim / 1e6, LockFree / 1e6, LockFreeElim / 1e6);
+    }
+
+    printf("\n(Mops/s)\n");
+
+    return err ? 1 : 0;
+}
+
+double RunContention(StackOptions_t options, int threads, uint64_t ops)
+{
+    StackId_t id = STACK_CTOR_EX(BENCH_CAPACITY, &options);
+
+    // Keep size near capacity / 2 so the locked stack never resizes during the run.
+
+    for (int i = 0; i < BENCH_CAPACITY / 2; i++)
+    {
+        StackPush(id, (StackElem_t) i);
+    }
+
+    pthread_t*   workers = (pthread_t*) calloc((size_t) threads, sizeof(pthread_t));
+
+    BenchArgs_t  args    = {id, ops};
+
+    double start = Now();
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, PairWorker, &args);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    double elapsed = Now() - start;
+
+    free(workers);
+
+    StackDtor(id);
+
+    return 2.0 * (double) ops * threads / elapsed;
+}
+
+void* PairWorker(void* args)
+{
+    BenchArgs_t* bench = (BenchArgs_t*) args;
+
+    for (uint64_t i = 0; i < bench->ops; i++)
+    {
+        StackPush(bench->id, i);
+
+        StackPop(bench->id);
+    }
+
+    return NULL;
+}
+
+double Now()
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
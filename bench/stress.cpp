@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "stack.h"
+
+// Shared-stack stress harness for the THREAD_PROTECTION path and the lock-free
+// modes.
+//
+//     bench_stress [-t threads] [-r push %] [-s stacks] [-d duration, ms] [-m mode]
+//
+// mode is one of locked (the default), locked+elim, lockfree and lockfree+elim,
+// the StackMode and elimination options the stacks are constructed with.
+//
+// Every thread picks a random shared stack and pushes (with probability push %)
+// or pops one element until the time is up. Pushed values are unique per thread,
+// so at the end the remaining elements are drained and the sum and xor of all
+// popped values must equal those of all pushed ones: any lost or duplicated
+// element shows up as a mismatch.
+//
+// The library does not expose its mutexes, so lock times are derived: hold is
+// the mean call latency of a one-thread run, wait is the contended mean minus it.
+
+const int      STRESS_THREADS  = 4;
+
+const int      STRESS_RATIO    = 50;
+
+const int      STRESS_STACKS   = 1;
+
+const uint64_t STRESS_DURATION = 1000;
+
+const int      STRESS_MAX_STACKS = 1024;
+
+struct StressMode_t
+{
+    const char*      name;
+    StackMode        mode;
+    bool             elimination;
+};
+
+const StressMode_t STRESS_MODES[] = {{"locked",        STACK_MODE_LOCKED,    false},
+                                     {"locked+elim",   STACK_MODE_LOCKED,    true },
+                                     {"lockfree",      STACK_MODE_LOCK_FREE, false},
+                                     {"lockfree+elim", STACK_MODE_LOCK_FREE, true }};
+
+struct StressChecksum_t
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t xored;
+};
+
+struct StressThread_t
+{
+    int              index;
+    int              ratio;
+    int              stacks;
+    const StackId_t* ids;
+    uint64_t         ops;
+    uint64_t         nanos;    // time spent inside the stack calls
+    uint64_t         WorstNs;
+    StressChecksum_t pushed;
+    StressChecksum_t popped;
+};
+
+struct StressResult_t
+{
+    double           OpsPerSec;
+    double           MeanCallNs;
+    uint64_t         WorstNs;
+    double           fairness;
+    uint64_t         MinOps;
+    uint64_t         MaxOps;
+    bool             balanced;
+};
+
+static bool           StressRunning = false;
+
+static StressResult_t RunStress      (int threads, int ratio, int stacks, uint64_t duration,
+                                      const StackOptions_t* options, bool verbose);
+
+static void*          StressWorker   (void* args);
+
+static void           ChecksumAdd    (StressChecksum_t* checksum, StackElem_t value);
+
+static inline uint64_t Now           ();
+
+int main(int argc, char* argv[])
+{
+    int      threads  = STRESS_THREADS;
+
+    int      ratio    = STRESS_RATIO;
+
+    int      stacks   = STRESS_STACKS;
+
+    uint64_t duration = STRESS_DURATION;
+
+    const StressMode_t* mode = &STRESS_MODES[0];
+
+    int      option   = 0;
+
+    while ((option = getopt(argc, argv, "t:r:s:d:m:")) != -1)
+    {
+        switch (option)
+        {
+            case 't':
+                threads  = atoi(optarg);
+                break;
+
+            case 'r':
+                ratio    = atoi(optarg);
+                break;
+
+            case 's':
+                stacks   = atoi(optarg);
+                break;
+
+            case 'd':
+                duration = strtoull(optarg, nullptr, 10);
+                break;
+
+            case 'm':
+                mode     = nullptr;
+
+                for (size_t i = 0; i < sizeof(STRESS_MODES) / sizeof(STRESS_MODES[0]); i++)
+                {
+                    if (strcmp(optarg, STRESS_MODES[i].name) == 0)
+                    {
+                        mode = &STRESS_MODES[i];
+                    }
+                }
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-t threads] [-r push %%] [-s stacks] [-d duration, ms] [-m mode]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (threads < 1 || stacks < 1 || stacks > STRESS_MAX_STACKS || ratio < 0 || ratio > 100 || !mode)
+    {
+        fprintf(stderr, "need threads >= 1, 1 <= stacks <= %d, 0 <= push %% <= 100, "
+                        "mode locked, locked+elim, lockfree or lockfree+elim\n", STRESS_MAX_STACKS);
+
+        return 1;
+    }
+
+    StackOptions_t options = DEFAULT_STACK_OPTIONS;
+
+    options.mode        = mode->mode;
+
+    options.elimination = mode->elimination;
+
+    printf("%d threads, %d%% pushes, %d shared %s stacks, %lu ms\n\n", threads, ratio, stacks, mode->name, duration);
+
+    StressResult_t alone  = RunStress(1, ratio, stacks, duration / 4 + 1, &options, false);
+
+    StressResult_t shared = RunStress(threads, ratio, stacks, duration, &options, true);
+
+    double wait = shared.MeanCallNs - alone.MeanCallNs;
+
+    printf("\nthroughput      %12.2f Mops/s (one thread: %.2f)\n", shared.OpsPerSec / 1e6, alone.OpsPerSec / 1e6);
+
+    printf("fairness        %12.3f (Jain), ops per thread %lu..%lu\n", shared.fairness, shared.MinOps, shared.MaxOps);
+
+    printf("lock hold       %12.1f ns (one-thread call)\n", alone.MeanCallNs);
+
+    printf("lock wait       %12.1f ns mean, %lu ns worst call\n", wait > 0 ? wait : 0, shared.WorstNs);
+
+    printf("checksum        %12s\n", alone.balanced && shared.balanced ? "ok" : "MISMATCH");
+
+    return alone.balanced && shared.balanced ? 0 : 1;
+}
+
+StressResult_t RunStress(int threads, int ratio, int stacks, uint64_t duration, const StackOptions_t* options, bool verbose)
+{
+    StressResult_t result = {};
+
+    StackId_t*      ids     = (StackId_t*)      calloc((size_t) stacks,  sizeof(StackId_t));
+
+    StressThread_t* workers = (StressThread_t*) calloc((size_t) threads, sizeof(StressThread_t));
+
+    pthread_t*      handles = (pthread_t*)      calloc((size_t) threads, sizeof(pthread_t));
+
+    if (!ids || !workers || !handles)
+    {
+        free(ids);
+
+        free(workers);
+
+        free(handles);
+
+        return result;
+    }
+
+    int created = 0;
+
+    for (; created < stacks; created++)
+    {
+        ids[created] = STACK_CTOR_EX(MIN_STACK_SIZE, options);
+
+        if (ids[created] == INVALID_STACK_ID)
+        {
+            break;
+        }
+    }
+
+    if (created < stacks) // result.balanced stays false
+    {
+        fprintf(stderr, "StackCtorEx failed for stack %d\n", created);
+
+        for (int i = 0; i < created; i++)
+        {
+            StackDtor(ids[i]);
+        }
+
+        free(ids);
+
+        free(workers);
+
+        free(handles);
+
+        return result;
+    }
+
+    __atomic_store_n(&StressRunning, true, __ATOMIC_RELEASE);
+
+    uint64_t start = Now();
+
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i] = {i, ratio, stacks, ids, 0, 0, 0, {}, {}};
+
+        pthread_create(&handles[i], NULL, StressWorker, &workers[i]);
+    }
+
+    struct timespec pause = {(time_t) (duration / 1000), (long) (duration % 1000) * 1000000};
+
+    nanosleep(&pause, nullptr);
+
+    __atomic_store_n(&StressRunning, false, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(handles[i], NULL);
+    }
+
+    double elapsed = (double) (Now() - start) * 1e-9;
+
+    StressChecksum_t pushed = {};
+
+    StressChecksum_t popped = {};
+
+    uint64_t ops   = 0;
+
+    uint64_t nanos = 0;
+
+    double   sum   = 0;
+
+    double   sqr   = 0;
+
+    result.MinOps = UINT64_MAX;
+
+    if (verbose)
+    {
+        printf("%8s %12s %12s %14s\n", "thread", "ops", "Mops/s", "mean call, ns");
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        StressThread_t* worker = &workers[i];
+
+        if (verbose)
+        {
+            printf("%8d %12lu %12.2f %14.1f\n", i, worker->ops, (double) worker->ops / elapsed / 1e6,
+                   worker->ops ? (double) worker->nanos / (double) worker->ops : 0);
+        }
+
+        ops   += worker->ops;
+
+        nanos += worker->nanos;
+
+        sum   += (double) worker->ops;
+
+        sqr   += (double) worker->ops * (double) worker->ops;
+
+        result.MinOps  = worker->ops < result.MinOps  ? worker->ops     : result.MinOps;
+
+        result.MaxOps  = worker->ops > result.MaxOps  ? worker->ops     : result.MaxOps;
+
+        result.WorstNs = worker->WorstNs > result.WorstNs ? worker->WorstNs : result.WorstNs;
+
+        pushed.count += worker->pushed.count;
+        pushed.sum   += worker->pushed.sum;
+        pushed.xored ^= worker->pushed.xored;
+
+        popped.count += worker->popped.count;
+        popped.sum   += worker->popped.sum;
+        popped.xored ^= worker->popped.xored;
+    }
+
+    for (int i = 0; i < stacks; i++)
+    {
+        StackElem_t value = 0;
+
+        while (StackPopN(ids[i], &value, 1) == EXECUTED)
+        {
+            ChecksumAdd(&popped, value);
+        }
+
+        if (STACK_VERIFY(ids[i]) == STACK_DAMAGED)
+        {
+            popped.count = UINT64_MAX;
+        }
+
+        StackDtor(ids[i]);
+    }
+
+    result.OpsPerSec  = (double) ops / elapsed;
+
+    result.MeanCallNs = ops ? (double) nanos / (double) ops : 0;
+
+    result.fairness   = sqr > 0 ? sum * sum / ((double) threads * sqr) : 0;
+
+    result.balanced   = pushed.count == popped.count && pushed.sum == popped.sum && pushed.xored == popped.xored;
+
+    free(ids);
+
+    free(workers);
+
+    free(handles);
+
+    return result;
+}
+
+// Values are (thread + 1) << 40 | sequence number, never 0 and never repeated.
+
+void* StressWorker(void* args)
+{
+    StressThread_t* worker = (StressThread_t*) args;
+
+    uint32_t random = 2463534242u + (uint32_t) worker->index * 7919;
+
+    uint64_t next   = 0;
+
+    while (__atomic_load_n(&StressRunning, __ATOMIC_ACQUIRE))
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+
+        StackId_t id = worker->ids[random % (uint32_t) worker->stacks];
+
+        bool push = (int) ((random >> 8) % 100) < worker->ratio;
+
+        StackElem_t value = ((uint64_t) worker->index + 1) << 40 | next;
+
+        uint64_t start = Now();
+
+        StackReturnCode code = push ? StackPush(id, value) : StackPopN(id, &value, 1);
+
+        uint64_t spent = Now() - start;
+
+        worker->nanos  += spent;
+
+        worker->WorstNs = spent > worker->WorstNs ? spent : worker->WorstNs;
+
+        worker->ops++;
+
+        if (code != EXECUTED)
+        {
+            continue; // pop from an empty stack
+        }
+
+        if (push)
+        {
+            ChecksumAdd(&worker->pushed, value);
+
+            next++;
+        }
+        else
+        {
+            ChecksumAdd(&worker->popped, value);
+        }
+    }
+
+    return nullptr;
+}
+
+void ChecksumAdd(StressChecksum_t* checksum, StackElem_t value)
+{
+    checksum->count++;
+
+    checksum->sum   += value;
+
+    checksum->xored ^= value;
+}
+
+uint64_t Now()
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stack.h"
+
+// Protection cost suite. `make bench` builds this file once per protection
+// configuration (SUITE_CONFIG names it) against a library built with the same
+// flags, so every row is the whole stack at that protection level.
+//
+//     bench_suite_<config> [-n ops] [-c results.csv] [-j results.jsonl]
+//
+// Every pattern runs twice: once untimed per operation for ops/s, once with a
+// clock read around each call for the latency percentiles. Ops/s only counts the
+// time spent in the measured calls: the refills and drains a pattern needs
+// between them, and the ctor/dtor, are left out of both. The clock overhead is
+// measured at start-up and subtracted. Bulk rows count elements for ops/s and
+// whole PushN/PopN calls for latency.
+
+#ifndef SUITE_CONFIG
+#define SUITE_CONFIG "custom"
+#endif
+
+#ifdef DEBUG // every operation is dumped with all of its elements
+
+const uint64_t SUITE_OPS     = 500;
+
+const uint64_t SUITE_SIZES[] = {16};
+
+#else
+
+const uint64_t SUITE_OPS     = 1000000;
+
+const uint64_t SUITE_SIZES[] = {16, 1024, 65536};
+
+#endif
+
+const size_t   SUITE_BATCH   = 64;
+
+// What a pattern did: elements moved, timed calls (the same but for bulk) and
+// the time spent in the measured sections.
+
+struct SuiteRun_t
+{
+    uint64_t    ops;
+    uint64_t    calls;
+    uint64_t    ns;
+};
+
+typedef SuiteRun_t (*SuitePattern_t)(uint64_t size, uint64_t ops, uint64_t* samples);
+
+struct SuiteResult_t
+{
+    const char* pattern;
+    uint64_t    size;
+    uint64_t    ops;
+    double      OpsPerSec;
+    uint64_t    p50;
+    uint64_t    p99;
+    uint64_t    p999;
+};
+
+static SuiteRun_t    RunPush         (uint64_t size, uint64_t ops, uint64_t* samples);
+
+static SuiteRun_t    RunPop          (uint64_t size, uint64_t ops, uint64_t* samples);
+
+static SuiteRun_t    RunMixed        (uint64_t size, uint64_t ops, uint64_t* samples);
+
+static SuiteRun_t    RunBulk         (uint64_t size, uint64_t ops, uint64_t* samples);
+
+static SuiteRun_t    RunResize       (uint64_t size, uint64_t ops, uint64_t* samples);
+
+static SuiteResult_t Measure         (const char* pattern, SuitePattern_t run, uint64_t size, uint64_t ops);
+
+static void          Report          (const SuiteResult_t* result, FILE* csv, FILE* json);
+
+static uint64_t      Percentile      (const uint64_t* sorted, uint64_t count, double rank);
+
+static int           CompareSamples  (const void* a, const void* b);
+
+static uint64_t      CalibrateClock  ();
+
+static inline uint64_t Now           ();
+
+static inline uint64_t Since         (uint64_t start);
+
+static uint64_t      ClockOverhead = 0;
+
+int main(int argc, char* argv[])
+{
+    uint64_t ops = SUITE_OPS;
+
+    FILE* csv  = nullptr;
+
+    FILE* json = nullptr;
+
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "n:c:j:")) != -1)
+    {
+        switch (option)
+        {
+            case 'n':
+                ops = strtoull(optarg, nullptr, 10);
+                break;
+
+            case 'c':
+                csv = fopen(optarg, "a");
+                break;
+
+            case 'j':
+                json = fopen(optarg, "a");
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-n ops] [-c results.csv] [-j results.jsonl]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (csv && ftell(csv) == 0)
+    {
+        fprintf(csv, "config,pattern,size,ops,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    }
+
+    ClockOverhead = CalibrateClock();
+
+    printf("config %s, %lu ops per pattern, clock overhead %lu ns subtracted\n\n", SUITE_CONFIG, ops, ClockOverhead);
+
+    printf("%-8s %8s %12s %10s %10s %10s\n", "pattern", "size", "Mops/s", "p50, ns", "p99, ns", "p999, ns");
+
+    const char*    names   [] = {"push",  "pop",  "mixed",  "bulk",  "resize"};
+
+    SuitePattern_t patterns[] = {RunPush, RunPop, RunMixed, RunBulk, RunResize};
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+    {
+        for (size_t s = 0; s < sizeof(SUITE_SIZES) / sizeof(SUITE_SIZES[0]); s++)
+        {
+            SuiteResult_t result = Measure(names[p], patterns[p], SUITE_SIZES[s], ops);
+
+            Report(&result, csv, json);
+        }
+    }
+
+    if (csv)
+    {
+        fclose(csv);
+    }
+
+    if (json)
+    {
+        fclose(json);
+    }
+
+    return err ? 1 : 0;
+}
+
+SuiteResult_t Measure(const char* pattern, SuitePattern_t run, uint64_t size, uint64_t ops)
+{
+    SuiteResult_t result = {pattern, size, ops, 0, 0, 0, 0};
+
+    SuiteRun_t done = run(size, ops, nullptr);
+
+    result.OpsPerSec = (double) done.ops * 1e9 / (double) (done.ns ? done.ns : 1);
+
+    uint64_t* samples = (uint64_t*) calloc(ops, sizeof(uint64_t));
+
+    if (!samples)
+    {
+        err |= INVALID_DATA_POINTER;
+
+        return result;
+    }
+
+    uint64_t count = run(size, ops, samples).calls;
+
+    qsort(samples, count, sizeof(uint64_t), CompareSamples);
+
+    result.p50  = Percentile(samples, count, 0.5);
+
+    result.p99  = Percentile(samples, count, 0.99);
+
+    result.p999 = Percentile(samples, count, 0.999);
+
+    free(samples);
+
+    return result;
+}
+
+// Pushes onto a reserved stack, so no push resizes; popped back untimed.
+
+SuiteRun_t RunPush(uint64_t size, uint64_t ops, uint64_t* samples)
+{
+    StackId_t id = STACK_CTOR((int) size);
+
+    StackReserve(id, size);
+
+    uint64_t done = 0;
+
+    uint64_t ns   = 0;
+
+    while (done < ops)
+    {
+        uint64_t pushed = 0;
+
+        uint64_t section = Now();
+
+        for (; pushed < size && done < ops; pushed++, done++)
+        {
+            uint64_t start = samples ? Now() : 0;
+
+            StackPush(id, done);
+
+            if (samples)
+            {
+                samples[done] = Now() - start;
+            }
+        }
+
+        ns += Since(section);
+
+        for (; pushed > 0; pushed--)
+        {
+            StackPop(id);
+        }
+    }
+
+    StackDtor(id);
+
+    return {done, done, ns};
+}
+
+SuiteRun_t RunPop(uint64_t size, uint64_t ops, uint64_t* samples)
+{
+    StackId_t id = STACK_CTOR((int) size);
+
+    StackReserve(id, size);
+
+    uint64_t done = 0;
+
+    uint64_t ns   = 0;
+
+    while (done < ops)
+    {
+        for (uint64_t i = 0; i < size; i++)
+        {
+            StackPush(id, i);
+        }
+
+        uint64_t popped = 0;
+
+        uint64_t section = Now();
+
+        for (; popped < size && done < ops; popped++, done++)
+        {
+            uint64_t start = samples ? Now() : 0;
+
+            StackPop(id);
+
+            if (samples)
+            {
+                samples[done] = Now() - start;
+            }
+        }
+
+        ns += Since(section);
+
+        for (; popped < size; popped++)
+        {
+            StackPop(id);
+        }
+    }
+
+    StackDtor(id);
+
+    return {done, done, ns};
+}
+
+// Random pushes and pops around half of size.
+
+SuiteRun_t RunMixed(uint64_t size, uint64_t ops, uint64_t* samples)
+{
+    StackId_t id = STACK_CTOR((int) size);
+
+    StackReserve(id, size);
+
+    uint64_t level = 0;
+
+    for (; level < size / 2; level++)
+    {
+        StackPush(id, level);
+    }
+
+    uint32_t random = 2463534242;
+
+    uint64_t section = Now();
+
+    for (uint64_t done = 0; done < ops; done++)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+
+        bool push = level == 0 || (level + 1 < size && random % 2);
+
+        uint64_t start = samples ? Now() : 0;
+
+        if (push)
+        {
+            StackPush(id, done);
+
+            level++;
+        }
+        else
+        {
+            StackPop(id);
+
+            level--;
+        }
+
+        if (samples)
+        {
+            samples[done] = Now() - start;
+        }
+    }
+
+    uint64_t ns = Since(section);
+
+    StackDtor(id);
+
+    return {ops, ops, ns};
+}
+
+SuiteRun_t RunBulk(uint64_t size, uint64_t ops, uint64_t* samples)
+{
+    StackId_t id = STACK_CTOR((int) size);
+
+    StackReserve(id, size);
+
+    StackElem_t batch[SUITE_BATCH] = {};
+
+    uint64_t count = size < SUITE_BATCH ? size : SUITE_BATCH;
+
+    uint64_t done  = 0;
+
+    uint64_t calls = 0;
+
+    uint64_t ns    = 0;
+
+    while (done < ops)
+    {
+        uint64_t level = 0;
+
+        uint64_t section = Now();
+
+        for (; level + count <= size && done < ops; level += count, done += count, calls++)
+        {
+            uint64_t start = samples ? Now() : 0;
+
+            StackPushN(id, batch, count);
+
+            if (samples)
+            {
+                samples[calls] = Now() - start;
+            }
+        }
+
+        for (; level > 0 && done < ops; level -= count, done += count, calls++)
+        {
+            uint64_t start = samples ? Now() : 0;
+
+            StackPopN(id, batch, count);
+
+            if (samples)
+            {
+                samples[calls] = Now() - start;
+            }
+        }
+
+        ns += Since(section);
+
+        for (; level > 0; level -= count)
+        {
+            StackPopN(id, batch, count);
+        }
+    }
+
+    StackDtor(id);
+
+    return {done, calls, ns};
+}
+
+// A fresh minimum-capacity stack per round, filled to size and emptied, so the
+// default policy grows and shrinks it all the way.
+
+SuiteRun_t RunResize(uint64_t size, uint64_t ops, uint64_t* samples)
+{
+    uint64_t done = 0;
+
+    uint64_t ns   = 0;
+
+    while (done < ops)
+    {
+        StackId_t id = STACK_CTOR(MIN_STACK_SIZE);
+
+        uint64_t pushed = 0;
+
+        uint64_t section = Now();
+
+        for (; pushed < size && done < ops; pushed++, done++)
+        {
+            uint64_t start = samples ? Now() : 0;
+
+            StackPush(id, done);
+
+            if (samples)
+            {
+                samples[done] = Now() - start;
+            }
+        }
+
+        for (; pushed > 0 && done < ops; pushed--, done++)
+        {
+            uint64_t start = samples ? Now() : 0;
+
+            StackPop(id);
+
+            if (samples)
+            {
+                samples[done] = Now() - start;
+            }
+        }
+
+        ns += Since(section);
+
+        StackDtor(id);
+    }
+
+    return {done, done, ns};
+}
+
+void Report(const SuiteResult_t* result, FILE* csv, FILE* json)
+{
+    printf("%-8s %8lu %12.2f %10lu %10lu %10lu\n", result->pattern, result->size,
+           result->OpsPerSec / 1e6, result->p50, result->p99, result->p999);
+
+    if (csv)
+    {
+        fprintf(csv, "%s,%s,%lu,%lu,%.0f,%lu,%lu,%lu\n", SUITE_CONFIG, result->pattern, result->size,
+                result->ops, result->OpsPerSec, result->p50, result->p99, result->p999);
+    }
+
+    if (json)
+    {
+        fprintf(json, "{\"config\": \"%s\", \"pattern\": \"%s\", \"size\": %lu, \"ops\": %lu, "
+                      "\"ops_per_sec\": %.0f, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu}\n",
+                SUITE_CONFIG, result->pattern, result->size, result->ops,
+                result->OpsPerSec, result->p50, result->p99, result->p999);
+    }
+}
+
+uint64_t Percentile(const uint64_t* sorted, uint64_t count, double rank)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t index = (uint64_t) ((double) count * rank);
+
+    uint64_t sample = sorted[index < count ? index : count - 1];
+
+    return sample > ClockOverhead ? sample - ClockOverhead : 0;
+}
+
+int CompareSamples(const void* a, const void* b)
+{
+    uint64_t left  = *(const uint64_t*) a;
+
+    uint64_t right = *(const uint64_t*) b;
+
+    return (left > right) - (left < right);
+}
+
+// Median of back-to-back clock reads.
+
+uint64_t CalibrateClock()
+{
+    const int CALIBRATION_READS = 1001;
+
+    uint64_t samples[CALIBRATION_READS] = {};
+
+    for (int i = 0; i < CALIBRATION_READS; i++)
+    {
+        uint64_t start = Now();
+
+        samples[i] = Now() - start;
+    }
+
+    qsort(samples, CALIBRATION_READS, sizeof(uint64_t), CompareSamples);
+
+    return samples[CALIBRATION_READS / 2];
+}
+
+uint64_t Now()
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// Time since start less the clock read that ends it.
+
+uint64_t Since(uint64_t start)
+{
+    uint64_t elapsed = Now() - start;
+
+    return elapsed > ClockOverhead ? elapsed - ClockOverhead : 0;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+
+#include "stack.h"
+#include "stack.hpp"
+
+const uint64_t TEMPLATE_OPS    = 10000000;
+
+const int      TEMPLATE_ROUNDS = 5;
+
+static double  RunVector      (uint64_t ops);
+
+template <class Policy>
+static double  RunTemplate    (uint64_t ops);
+
+static double  RunCApi        (uint64_t ops);
+
+static double  Now            ();
+
+// Push ops elements, then pop them all, best of TEMPLATE_ROUNDS. The sum of the
+// popped values is checked so the compiler can not drop the loops.
+
+int main(int argc, const char* argv[])
+{
+    uint64_t ops = argc > 1 ? strtoull(argv[1], nullptr, 10) : TEMPLATE_OPS;
+
+    printf("pushes + pops per run: %lu\n\n", ops);
+
+    printf("%-32s %12s\n", "stack", "Mops/s");
+
+    printf("%-32s %12.2f\n", "std::vector<uint64_t>",            RunVector(ops)                          / 1e6);
+
+    printf("%-32s %12.2f\n", "Stack<uint64_t, Release>",         RunTemplate<ReleaseStackPolicy_t>(ops)  / 1e6);
+
+    printf("%-32s %12.2f\n", "Stack<uint64_t, Checked>",         RunTemplate<CheckedStackPolicy_t>(ops)  / 1e6);
+
+    printf("%-32s %12.2f\n", "Stack<uint64_t, Thread>",          RunTemplate<ThreadStackPolicy_t>(ops)   / 1e6);
+
+    printf("%-32s %12.2f\n", "StackPush/StackPop (C API)",       RunCApi(ops)                            / 1e6);
+
+    return err ? 1 : 0;
+}
+
+double RunVector(uint64_t ops)
+{
+    double best = 0;
+
+    for (int round = 0; round < TEMPLATE_ROUNDS; round++)
+    {
+        std::vector<uint64_t> stack;
+
+        stack.reserve(MIN_STACK_SIZE);
+
+        uint64_t sum = 0;
+
+        double start = Now();
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            stack.push_back(i);
+        }
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            sum += stack.back();
+
+            stack.pop_back();
+        }
+
+        double rate = 2.0 * (double) ops / (Now() - start);
+
+        best = rate > best ? rate : best;
+
+        if (sum != ops * (ops - 1) / 2)
+        {
+            err |= DAMAGED_STACK_ERR;
+        }
+    }
+
+    return best;
+}
+
+template <class Policy>
+double RunTemplate(uint64_t ops)
+{
+    double best = 0;
+
+    for (int round = 0; round < TEMPLATE_ROUNDS; round++)
+    {
+        Stack<uint64_t, Policy> stack;
+
+        uint64_t sum   = 0;
+
+        uint64_t value = 0;
+
+        double start = Now();
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            stack.Push(i);
+        }
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            stack.Pop(&value);
+
+            sum += value;
+        }
+
+        double rate = 2.0 * (double) ops / (Now() - start);
+
+        best = rate > best ? rate : best;
+
+        if (sum != ops * (ops - 1) / 2)
+        {
+            err |= DAMAGED_STACK_ERR;
+        }
+    }
+
+    return best;
+}
+
+double RunCApi(uint64_t ops)
+{
+    if (ops > MAX_STACK_SIZE)
+    {
+        ops = MAX_STACK_SIZE;
+    }
+
+    double best = 0;
+
+    for (int round = 0; round < TEMPLATE_ROUNDS; round++)
+    {
+        StackId_t id = STACK_CTOR(MIN_STACK_SIZE);
+
+        uint64_t sum = 0;
+
+        double start = Now();
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            StackPush(id, i);
+        }
+
+        for (uint64_t i = 0; i < ops; i++)
+        {
+            sum += StackPop(id);
+        }
+
+        double rate = 2.0 * (double) ops / (Now() - start);
+
+        best = rate > best ? rate : best;
+
+        StackDtor(id);
+
+        if (sum != ops * (ops - 1) / 2)
+        {
+            err |= DAMAGED_STACK_ERR;
+        }
+    }
+
+    return best;
+}
+
+double Now()
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
@@ -6,10 +6,69 @@
 #ifndef ALLOCATION_H__
 #define ALLOCATION_H__
 
+typedef struct AllocStats
+{
+    uint64_t LiveBytes;
+    uint64_t PeakBytes;
+    uint64_t LiveBlocks;
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t untracked;   // events the tracker table had no room for
+} AllocStats_t;
+
+void* log_malloc(FILE* MemoryLogFile, size_t SizeInBytes);
+
 void* log_calloc(FILE* MemoryLogFile, size_t nMemb, size_t size);
 
 void* log_realloc(FILE* MemoryLogFile, void* ptr, size_t SizeInBytes);
 
 void* log_free(FILE* MemoryLogFile, void* ptr);
 
+void* log_aligned_calloc(FILE* MemoryLogFile, size_t alignment, size_t SizeInBytes);
+
+void  log_aligned_free(FILE* MemoryLogFile, void* ptr);
+
+void  alloc_trace_stats(AllocStats_t* stats);
+
+void  alloc_trace_flush();
+
+void  alloc_trace_report(FILE* fp);
+
+void* pool_malloc(size_t SizeInBytes);
+
+void* pool_calloc(size_t nMemb, size_t size);
+
+void* pool_realloc(void* ptr, size_t SizeInBytes);
+
+void  pool_free(void* ptr);
+
+void* mapped_alloc(size_t ReserveInBytes, size_t SizeInBytes);
+
+void* mapped_realloc(void* ptr, size_t SizeInBytes);
+
+void* mapped_clone(void* ptr);
+
+void  mapped_free(void* ptr);
+
+void* file_alloc(const char* path, uint64_t layout, size_t ReserveInBytes, size_t SizeInBytes);
+
+void* file_open(const char* path, uint64_t layout, size_t ReserveInBytes);
+
+void* file_realloc(void* ptr, size_t SizeInBytes);
+
+void  file_free(void* ptr);
+
+void* aligned_calloc(size_t alignment, size_t SizeInBytes);
+
+void  aligned_free(void* ptr);
+
+void* guarded_alloc(size_t SizeInBytes);
+
+void* guarded_realloc(void* ptr, size_t SizeInBytes);
+
+void  guarded_free(void* ptr);
+
+int   guarded_hit(const void* ptr, const void* address);
+
 #endif // ALLOCATION_H__
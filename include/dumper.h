@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stack.h>
+
+#ifndef DUMPER_H__
+#define DUMPER_H__
+
+const int DUMP_RECORD_ELEMS = 8;
+
+const int DUMP_RING_SIZE    = 4096;
+
+const char     TRACE_MAGIC[8] = "STKTRCE";
+
+const uint32_t TRACE_VERSION  = 1;
+
+const int      TRACE_STRINGS  = 1024;
+
+const uint64_t TRACE_MAX_ELEMS = UINT32_MAX / sizeof(StackElem_t); // what a uint32_t payload holds
+
+// Everything StackDump prints, captured at the call site. In ASYNC_DUMP mode only
+// the top DUMP_RECORD_ELEMS live elements travel with the record.
+
+struct DumpRecord_t
+{
+    uint64_t     timestamp;
+    uint64_t     err;
+    const void*  address;
+    const char*  name;
+    const char*  file;
+    int          line;
+    const char*  function;
+    const char*  BornFile;
+    int          BornLine;
+    const char*  BornFunc;
+    StackId_t    id;
+    Canary_t     LeftCanary;
+    Canary_t     RightCanary;
+    Canary_t     DataLeftCanary;
+    Canary_t     DataRightCanary;
+    uint64_t     StructHash;
+    uint64_t     DataHash;
+    uint64_t     capacity;
+    uint64_t     size;
+    uint64_t     touched;     // slots from here on were never written (LazyPoison)
+    bool         LostStack;
+    bool         LostData;
+    uint64_t     ElemsFirst;
+    uint64_t     ElemsCount;
+    StackElem_t  elems[DUMP_RECORD_ELEMS];
+};
+
+// Binary trace (BINARY_DUMP builds): a TraceHeader_t followed by fixed-size
+// TraceRecord_t's. Strings are written once as TRACE_STRING records keyed by
+// their address and referenced by that key afterwards; a record is followed by
+// `payload` raw bytes (string text or StackElem_t's starting at ElemsFirst).
+
+typedef enum TraceKinds
+{
+    TRACE_DUMP            = 1,
+    TRACE_STRING          = 2,
+} TraceKind;
+
+typedef enum TraceOps
+{
+    TRACE_OP_OTHER        = 0,
+    TRACE_OP_CTOR         = 1,
+    TRACE_OP_DTOR         = 2,
+    TRACE_OP_PUSH         = 3,
+    TRACE_OP_POP          = 4,
+    TRACE_OP_RESIZE       = 5,
+    TRACE_OP_VERIFY       = 6,
+} TraceOp;
+
+typedef enum TraceFlags
+{
+    TRACE_LOST_STACK      = 1,
+    TRACE_LOST_DATA       = 2,
+    TRACE_WRITTEN_ELEMS   = 4,    // payload is the whole written prefix [0, touched)
+} TraceFlag;
+
+struct TraceHeader_t
+{
+    char         magic[8];
+    uint32_t     version;
+    uint32_t     RecordSize;
+};
+
+struct TraceRecord_t
+{
+    uint32_t     kind;
+    uint32_t     op;
+    uint64_t     timestamp;
+    uint64_t     err;
+    uint64_t     address;
+    int64_t      id;
+    uint64_t     name;
+    uint64_t     file;
+    uint64_t     function;
+    uint64_t     BornFile;
+    uint64_t     BornFunc;
+    int32_t      line;
+    int32_t      BornLine;
+    Canary_t     LeftCanary;
+    Canary_t     RightCanary;
+    Canary_t     DataLeftCanary;
+    Canary_t     DataRightCanary;
+    uint64_t     StructHash;
+    uint64_t     DataHash;
+    uint64_t     capacity;
+    uint64_t     size;
+    uint32_t     flags;
+    uint32_t     payload;
+    uint64_t     ElemsFirst;
+};
+
+uint64_t                 DumpNow             ();
+
+StackReturnCode          DumpEmit            (FILE* fp, const DumpRecord_t* record, const StackElem_t* data);
+
+StackReturnCode          DumpWrite           (FILE* fp, const DumpRecord_t* record, const StackElem_t* data);
+
+StackReturnCode          TraceStart          (FILE* fp);
+
+StackReturnCode          TraceWrite          (FILE* fp, const DumpRecord_t* record, const StackElem_t* data);
+
+StackReturnCode          DumpAsyncStart      (FILE* fp);
+
+StackReturnCode          DumpAsyncPush       (const DumpRecord_t* record);
+
+StackReturnCode          DumpAsyncStop       ();
+
+#endif // DUMPER_H__
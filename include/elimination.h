@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stack.h>
+
+#ifndef ELIMINATION_H__
+#define ELIMINATION_H__
+
+struct EliminationArray_t;
+
+EliminationArray_t*      EliminationCtor     (FILE* MemoryLogFile);
+
+StackReturnCode          EliminationPush     (EliminationArray_t* elimination, StackElem_t value);
+
+StackReturnCode          EliminationPop      (EliminationArray_t* elimination, StackElem_t* value);
+
+StackReturnCode          EliminationDtor     (EliminationArray_t* elimination);
+
+#endif // ELIMINATION_H__
@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stack.h>
+
+#ifndef HASH_H__
+#define HASH_H__
+
+// Position-mixed element hash (splitmix64 finalizer). Data hashes are sums of
+// it, so pushing or popping one element updates them in O(1).
+
+static inline uint64_t DataElemHash(StackElem_t value, uint64_t pos)
+{
+    uint64_t x = value + 0x9E3779B97F4A7C15 * (pos + 1);
+
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+
+    return x ^ (x >> 31);
+}
+
+// Block hashes for full recounts (src/hash.cpp). The kernel is chosen once per
+// process (AVX2, SSE4.2 crc32 or scalar), every backend returns the same value.
+
+uint64_t    DataBlockHash   (const StackElem_t* data, uint64_t size, uint64_t first); // sum of DataElemHash(data[i], first + i)
+
+uint64_t    StructBlockHash (uint64_t hash, const void* block, size_t size); // CRC32C, chainable
+
+const char* HashBackend     ();
+
+StackReturnCode HashCheckKernels(const StackElem_t* data, uint64_t size, uint64_t first,
+                                 const void* block, size_t BlockSize); // every kernel vs scalar, for src/test.cpp
+
+#endif // HASH_H__
@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stack.h>
+#include <elimination.h>
+
+#ifndef LOCKFREE_H__
+#define LOCKFREE_H__
+
+struct LockFreeStack_t;
+
+LockFreeStack_t*         LockFreeCtor        (uint64_t capacity, EliminationArray_t* elimination, FILE* MemoryLogFile);
+
+StackReturnCode          LockFreePush        (LockFreeStack_t* LockFree, StackElem_t value);
+
+StackReturnCode          LockFreePop         (LockFreeStack_t* LockFree, StackElem_t* value);
+
+StackReturnCode          LockFreeDtor        (LockFreeStack_t* LockFree);
+
+#endif // LOCKFREE_H__
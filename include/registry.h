@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <stack.h>
+
+#ifndef REGISTRY_H__
+#define REGISTRY_H__
+
+struct Stack_t;
+
+struct EliminationArray_t;
+
+// Sampling state of the per-operation checks. It changes on every operation, so
+// it is kept out of Stack_t, where each change would need a new StructHash.
+
+struct StackCheckState_t
+{
+    StackCheckPolicy_t   policy;
+    StackCheckCounters_t counters;
+    uint64_t             tick;
+    uint64_t             threshold;    // SAMPLED: check while random < threshold
+    uint64_t             random;
+    uint64_t             WindowStart;  // BUDGET: current one-second window, ns
+    uint64_t             WindowSpent;
+    bool                 due;          // decided by the check before the operation
+    bool                 pending;      // skipped since the last full StackVerify
+    bool                 damaged;      // already reported by StackScrub
+};
+
+// Registry slot. Everything here stays at a fixed address for the life of the
+// process, unlike Stack_t which StackResize may move, so the fields that are
+// read before taking the lock live here, and so do the check state, the
+// statistics and the error codes.
+
+struct StackSlot_t
+{
+    Stack_t*            stack;
+    uint32_t            generation;
+    uint32_t            NextFree;
+    StackMode           mode;
+    EliminationArray_t* elimination;
+    StackCheckState_t   check;
+    StackStats_t        stats;
+    uint64_t            errors;       // StackError codes raised on this stack
+    bool                frozen;       // StackSnapshot: push/pop fail
+    pthread_mutex_t     mutex;
+};
+
+StackId_t                RegistryAcquire     ();
+
+StackSlot_t*             RegistryGet         (StackId_t StackId);
+
+StackReturnCode          RegistryRelease     (StackId_t StackId);
+
+StackId_t                RegistryNext        (StackId_t StackId);
+
+StackSlot_t*             RegistryFind        (bool (*match)(const StackSlot_t* slot, const void* args), const void* args);
+
+#endif // REGISTRY_H__
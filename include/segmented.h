@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stack.h>
+
+#ifndef SEGMENTED_H__
+#define SEGMENTED_H__
+
+const int SEGMENT_CHUNK_SIZE = 500; // chunk + pool header fit a 4 KiB block
+
+struct SegmentedStack_t;
+
+SegmentedStack_t*        SegmentedCtor       (FILE* MemoryLogFile);
+
+SegmentedStack_t*        SegmentedClone      (SegmentedStack_t* segments);
+
+StackReturnCode          SegmentedPush       (SegmentedStack_t* segments, StackElem_t value);
+
+StackReturnCode          SegmentedPop        (SegmentedStack_t* segments, StackElem_t* value);
+
+StackReturnCode          SegmentedPushN      (SegmentedStack_t* segments, const StackElem_t* values, size_t count);
+
+StackReturnCode          SegmentedPopN       (SegmentedStack_t* segments, StackElem_t* values, size_t count);
+
+uint64_t                 SegmentedSize       (const SegmentedStack_t* segments);
+
+uint64_t                 SegmentedCapacity   (const SegmentedStack_t* segments);
+
+StackReturnCode          SegmentedShrink     (SegmentedStack_t* segments);
+
+StackReturnCode          SegmentedVerify     (const SegmentedStack_t* segments);
+
+StackReturnCode          SegmentedDtor       (SegmentedStack_t* segments);
+
+#endif // SEGMENTED_H__
@@ -1,17 +1,31 @@
 #include  <stdint.h>
+#include  <stddef.h>
 #include  <pthread.h>
 
 #ifndef STACK_H__
 #define STACK_H__
 
+// The guard pages of GUARD_PROTECTION (see below) only cover the end of the
+// elements; Stack_t sits in front of them. On its own the mode therefore brings
+// the canaries along, whose left data canary catches writes below the elements.
+
+#if defined(GUARD_PROTECTION) && !defined(DEBUG) && !defined(HASH_PROTECTION) && !defined(THREAD_PROTECTION)
+
+#define CANARY_PROTECTION
+
+#endif
+
 #if defined(DEBUG) || defined(HASH_PROTECTION) || defined(CANARY_PROTECTION) || defined(THREAD_PROTECTION)
 
 #ifdef  DEBUG
 
 #define INIT(name) CANARY, __FILE__, __LINE__, __PRETTY_FUNCTION__, \
-                   #name, 0, 0, PTHREAD_MUTEX_INITIALIZER,          \
+                   #name, 0, 0,                                     \
                    false,  INVALID_STACK_ID, nullptr, nullptr,      \
-                   nullptr, 0, 0, 0, CANARY                         \
+                   nullptr, 0, 0, 0, STACK_MODE_LOCKED, nullptr,    \
+                   nullptr, nullptr, {}, 0,                         \
+                   STACK_STORAGE_HEAP, nullptr, false, 0,           \
+                   CANARY                                           \
 
 #define ON_DEBUG(...)             __VA_ARGS__
 
@@ -33,7 +47,7 @@
 
 #ifdef  THREAD_PROTECTION
 
-#define INIT(name) PTHREAD_MUTEX_INITIALIZER, false, INVALID_STACK_ID, nullptr, 0, 0, 0
+#define INIT(name) false, INVALID_STACK_ID, nullptr, 0, 0, 0, STACK_MODE_LOCKED, nullptr, nullptr, nullptr, {}, 0, STACK_STORAGE_HEAP, nullptr, false, 0
 
 #define ON_THREAD_PROTECTION(...) __VA_ARGS__
 
@@ -45,7 +59,7 @@
 
 #ifdef  CANARY_PROTECTION
 
-#define INIT(name) CANARY, false, INVALID_STACK_ID, nullptr, nullptr, nullptr, 0, 0, 0, CANARY
+#define INIT(name) CANARY, false, INVALID_STACK_ID, nullptr, nullptr, nullptr, 0, 0, 0, STACK_MODE_LOCKED, nullptr, nullptr, nullptr, {}, 0, STACK_STORAGE_HEAP, nullptr, false, 0, CANARY
 
 #define ON_CANARY_PROTECTION(...) __VA_ARGS__
 
@@ -57,7 +71,7 @@
 
 #ifdef  HASH_PROTECTION
 
-#define INIT(  name) 0, 0, false, INVALID_STACK_ID, nullptr, 0, 0, 0
+#define INIT(  name) 0, 0, false, INVALID_STACK_ID, nullptr, 0, 0, 0, STACK_MODE_LOCKED, nullptr, nullptr, nullptr, {}, 0, STACK_STORAGE_HEAP, nullptr, false, 0
 
 #define ON_HASH_PROTECTION(  ...) __VA_ARGS__
 
@@ -71,7 +85,7 @@
 
 #else
 
-#define INIT(          name) false, INVALID_STACK_ID, nullptr, 0, 0, 0
+#define INIT(          name) false, INVALID_STACK_ID, nullptr, 0, 0, 0, STACK_MODE_LOCKED, nullptr, nullptr, nullptr, {}, 0, STACK_STORAGE_HEAP, nullptr, false, 0
 
 #define ON_DEBUG(            ...)
 
@@ -83,22 +97,55 @@
 
 #endif
 
+// GUARD_PROTECTION puts every heap stack block between PROT_NONE pages, flush
+// against the one after it, so an overflow faults on the spot instead of being
+// found by the next canary check. The guards themselves cost nothing per
+// operation, only a mapping per stack. Underflows are left to the canaries (on
+// by default with this mode) or the hash; combined with THREAD_PROTECTION they go
+// unnoticed.
+
+#ifdef  GUARD_PROTECTION
+
+#define ON_GUARD_PROTECTION(...) __VA_ARGS__
+
+#else
+
+#define ON_GUARD_PROTECTION(...)
+
+#endif
+
 #define STACK_ASSERT(     code)    StackAssert    (code,            __LINE__, __FILE__, __PRETTY_FUNCTION__)
 
 #define STACK_IS_VALID(  stack)    StackIsValid   (stack ON_DEBUG(, __LINE__, __FILE__, __PRETTY_FUNCTION__))
 
 #define STACK_IS_DAMAGED(stack)    StackIsDamaged (stack,           __LINE__, __FILE__, __PRETTY_FUNCTION__)
 
+#define STACK_CHECK_BEFORE(stack)  StackCheckDamaged(stack, true,   __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
+#define STACK_CHECK_AFTER( stack)  StackCheckDamaged(stack, false,  __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
 #define STACK_CTOR(      capacity) StackCtor      (capacity,        __LINE__, __FILE__, __PRETTY_FUNCTION__)
 
+#define STACK_CTOR_EX(   capacity, options) \
+                                   StackCtorEx    (capacity, options, __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
+#define STACK_OPEN(      path)     StackOpen      (path,            __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
+#define STACK_CLONE(     stack)    StackClone     (stack,           __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
+#define STACK_SNAPSHOT(  stack)    StackSnapshot  (stack,           __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
+#define STACK_GROUP_CTOR(ids, count, capacity) \
+                                   StackGroupCtor (ids, count, capacity, __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
+#define STACK_VERIFY(    stack)    StackVerify    (stack,           __LINE__, __FILE__, __PRETTY_FUNCTION__)
+
 #define verified && ParseErr(stderr, err, __LINE__, __FILE__, __PRETTY_FUNCTION__)
 
 #define DEDHYPEBEAST  0xCEBA1488BADEDA
 
 #define STRUCT_HASH_OFFSET (uint64_t) &(((Stack_t*) nullptr)->StructHash)
 
-#define MUTEX_OFFSET       (uint64_t) &(((Stack_t*) nullptr)->mutex)
-
 #define PRINT_ERR(code, pow, str)      \
 if ((nextPow = code % pow) >= pow / 2) \
 {                                      \
@@ -111,23 +158,29 @@ typedef uint64_t StackElem_t;
 
 typedef uint64_t Canary_t;
 
-typedef int      StackId_t;
+typedef int64_t  StackId_t;
 
 const   int      MIN_STACK_SIZE   = 8;
 
 const   int      MAX_STACK_SIZE   = 1024*1024;
 
-const   int      MAX_STACK_AMOUNT = 16;
+const   int      MAX_MAPPED_STACK_SIZE = 1024*1024*1024;
+
+const   int      MAX_STACK_AMOUNT = 1024*1024;
+
+const   int      CACHE_LINE_SIZE  = 64;
 
 const   Canary_t CANARY = DEDHYPEBEAST;
 
 const   int      POISON = 0;
 
-extern  uint64_t err;
+// Error codes of the calling thread. Every thread accumulates its own, so failing
+// threads do not race on it, and `verified` reports the caller's errors only.
+// Codes raised on a stack are also kept per stack, see StackGetStackErr.
 
-#ifdef FILE_HTML
+extern  __thread uint64_t err;
 
-const char* const DUMP_FILE       = "dump.html";
+#ifdef FILE_HTML
 
 const char* const MEMORY_LOG_FILE = "memory.html";
 
@@ -137,8 +190,6 @@ const char* const MEMORY_LOG_FILE = "memory.html";
 
 #else
 
-const char* const DUMP_FILE       = "dump.log";
-
 const char* const MEMORY_LOG_FILE = "memory.log";
 
 #define ON_HTML(...)
@@ -147,6 +198,20 @@ const char* const MEMORY_LOG_FILE = "memory.log";
 
 #endif
 
+#if   defined(BINARY_DUMP)
+
+const char* const DUMP_FILE       = "dump.trace";
+
+#elif defined(FILE_HTML)
+
+const char* const DUMP_FILE       = "dump.html";
+
+#else
+
+const char* const DUMP_FILE       = "dump.log";
+
+#endif
+
 typedef enum StackReturnCodes
 {
     EXECUTED              =  0,
@@ -158,6 +223,128 @@ typedef enum StackReturnCodes
     INVALID_STACK_ID      = -6,
 } StackReturnCode;
 
+// A STACK_MODE_WORK_STEALING stack (StackGroupCtor makes one per worker) has a
+// single owner thread: only the owner may call StackPush/StackPop on it, while
+// any thread may StackSteal/StackGroupSteal from it. A push or pop from another
+// thread races with the owner's and can lose or duplicate elements.
+
+typedef enum StackModes
+{
+    STACK_MODE_LOCKED     = 0,
+    STACK_MODE_LOCK_FREE  = 1,
+    STACK_MODE_WORK_STEALING = 2,
+} StackMode;
+
+// STACK_STORAGE_MAPPED reserves address space for MAX_MAPPED_STACK_SIZE elements
+// and commits pages as the stack grows: the block never moves and growth does
+// not copy, which is what stacks of hundreds of millions of elements need.
+
+// STACK_STORAGE_SEGMENTED (locked mode only) keeps elements in a chain of
+// fixed-size chunks: growth never copies, element addresses stay stable and
+// push/pop latency is flat.
+// StackClone/StackSnapshot of such a stack share its chunks copy-on-write: O(1)
+// to take, then a chunk is copied when either side first writes to it. Mapped
+// stacks share their pages the same way; heap and file stacks are cloned by
+// copying the elements. A snapshot is a clone that refuses push/pop, StackReserve,
+// StackShrinkToFit and StackCheckPoison with STACK_FROZEN.
+
+// STACK_STORAGE_FILE is STACK_STORAGE_MAPPED backed by the file at options.path
+// (locked mode only). StackDtor leaves the stack in the file and StackOpen maps
+// it back in O(1); the elements are only hashed by the first full StackVerify.
+// StackCtorEx only creates the file or takes an empty one: an existing file with
+// anything in it is left untouched and the ctor fails with INVALID_FILE_POINTER.
+
+typedef enum StackStorages
+{
+    STACK_STORAGE_HEAP      = 0,
+    STACK_STORAGE_MAPPED    = 1,
+    STACK_STORAGE_SEGMENTED = 2,
+    STACK_STORAGE_FILE      = 3,
+} StackStorage;
+
+// Zero fields take the defaults, which reproduce the classic policy: double when
+// full, halve once size <= capacity / 4. Shrinking never goes below MinCapacity
+// or a StackReserve'd capacity and always leaves room for one more push; keep
+// ShrinkLoad below 1 / GrowthFactor so a push after a shrink does not regrow.
+
+typedef struct StackResizePolicy
+{
+    double    GrowthFactor;   // capacity multiplier when full, default 2
+    double    ShrinkLoad;     // shrink once size <= capacity * ShrinkLoad, default 1/4
+    uint64_t  MinCapacity;    // retained capacity, default MIN_STACK_SIZE
+    bool      NeverShrink;
+} StackResizePolicy_t;
+
+typedef struct StackResizeCounters
+{
+    uint64_t  grows;
+    uint64_t  shrinks;
+    uint64_t  BytesMoved;     // live elements copied by the resizes
+} StackResizeCounters_t;
+
+// How often push/pop run the struct/canary check (StackIsDamaged) around the
+// operation. STACK_CHECK_ALWAYS is the classic behaviour; the other modes bound
+// its cost and count what they skip. StackDtor runs a full StackVerify first if
+// any check was skipped since the last one, so damage is still caught at the end.
+
+typedef enum StackCheckModes
+{
+    STACK_CHECK_ALWAYS  = 0,
+    STACK_CHECK_EVERY_N = 1,  // one operation in period
+    STACK_CHECK_SAMPLED = 2,  // each operation with probability
+    STACK_CHECK_BUDGET  = 3,  // until the checks took BudgetNs in the current second
+} StackCheckMode;
+
+typedef struct StackCheckPolicy
+{
+    StackCheckMode      mode;
+    uint64_t            period;
+    double              probability;
+    uint64_t            BudgetNs;
+} StackCheckPolicy_t;
+
+typedef struct StackCheckCounters
+{
+    uint64_t            checked;  // operations that ran their checks
+    uint64_t            skipped;
+} StackCheckCounters_t;
+
+// Per-stack operation counters. They are relaxed, so a reader on another thread
+// may see a count that is a few operations behind, never a torn one. Lock waits
+// count only the pushes and pops that found the stack mutex taken.
+
+typedef struct StackStats
+{
+    uint64_t            pushes;
+    uint64_t            pops;
+    uint64_t            underflows;
+    uint64_t            grows;
+    uint64_t            shrinks;
+    uint64_t            BytesMoved;   // live elements copied by StackResize
+    uint64_t            PeakSize;
+    uint64_t            LockWaits;
+    uint64_t            LockWaitNs;
+} StackStats_t;
+
+typedef struct StackOptions
+{
+    StackMode           mode;
+    bool                elimination;
+    StackResizePolicy_t policy;
+    StackStorage        storage;
+    StackCheckPolicy_t  check;
+    const char*         path;     // STACK_STORAGE_FILE
+
+    // Free slots of a stack hold POISON. By default StackCtor and StackResize
+    // poison the whole capacity up front; with LazyPoison they write nothing past
+    // the slots pushes have reached, so a large reserve costs what is used, not
+    // what is reserved. Popped slots are poisoned either way. StackCheckPoison
+    // verifies the free slots on demand and poisons the never-touched ones then.
+    bool                LazyPoison;
+} StackOptions_t;
+
+const   StackOptions_t DEFAULT_STACK_OPTIONS = {STACK_MODE_LOCKED, false, {}, STACK_STORAGE_HEAP, {}, nullptr, false};
+
 typedef enum StackErrorCodes
 {
     NO_ERROR              = 0,
@@ -174,18 +361,76 @@ typedef enum StackErrorCodes
     INVALID_DATA_CANARY   = 1024,
     INVALID_STRUCT_CANARY = 2048,
     INVALID_STACK_ID_ERR  = 4096,
+    STACK_FROZEN          = 8192,
+    INVALID_POISON        = 16384,
 } StackErrorCode;
 
 StackId_t                StackCtor           (int capacity, int line, const char* file, const char* function);
 
+StackId_t                StackCtorEx         (int capacity, const StackOptions_t* options,
+                                              int line, const char* file, const char* function);
+
+StackId_t                StackOpen           (const char* path, int line, const char* file, const char* function);
+
+StackId_t                StackClone          (StackId_t StackId, int line, const char* file, const char* function);
+
+StackId_t                StackSnapshot       (StackId_t StackId, int line, const char* file, const char* function);
+
 StackId_t                GetStackId          ();
 
 StackReturnCode          StackPush           (StackId_t StackId, StackElem_t value);
 
 StackElem_t              StackPop            (StackId_t StackId);
 
+StackReturnCode          StackPushN          (StackId_t StackId, const StackElem_t* values, size_t count);
+
+StackReturnCode          StackPopN           (StackId_t StackId, StackElem_t* values, size_t count);
+
+StackReturnCode          StackSteal          (StackId_t StackId, StackElem_t* value);
+
+StackReturnCode          StackReserve        (StackId_t StackId, size_t capacity);
+
+StackReturnCode          StackShrinkToFit    (StackId_t StackId);
+
+StackReturnCode          StackGetResizeCounters(StackId_t StackId, StackResizeCounters_t* counters);
+
+StackReturnCode          StackGetCheckCounters(StackId_t StackId, StackCheckCounters_t* counters);
+
+StackReturnCode          StackGetStats       (StackId_t StackId, StackStats_t* stats);
+
+uint64_t                 StackGetErr         ();
+
+uint64_t                 StackClearErr       ();
+
+uint64_t                 StackGetStackErr    (StackId_t StackId);
+
+uint64_t                 StackClearStackErr  (StackId_t StackId);
+
+StackReturnCode          StackGetTotalStats  (StackStats_t* stats);
+
+StackReturnCode          StackDumpStats      (FILE* file);
+
 StackReturnCode          StackDtor           (StackId_t StackId);
 
+StackReturnCode          StackScrub          (StackId_t StackId);
+
+StackReturnCode          StackScrubAll       ();
+
+StackReturnCode          StackScrubStart     (uint64_t PeriodMs);
+
+StackReturnCode          StackScrubStop      ();
+
+StackReturnCode          StackGroupCtor      (StackId_t* ids, int count, int capacity,
+                                              int line, const char* file, const char* function);
+
+StackReturnCode          StackGroupSteal     (const StackId_t* ids, int count, int thief, StackElem_t* value);
+
+StackReturnCode          StackGroupDtor      (StackId_t* ids, int count);
+
+StackReturnCode          StackVerify         (StackId_t StackId, int line, const char* file, const char* function);
+
+StackReturnCode          StackCheckPoison    (StackId_t StackId);
+
 StackReturnCode          PrintErr            (FILE* fp, uint64_t code);
 
 StackReturnCode          ParseErr            (FILE* fp, uint64_t code, int line, const char* file, const char* function);
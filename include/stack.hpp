@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stack.h>
+#include <hash.h>
+
+#ifndef STACK_HPP__
+#define STACK_HPP__
+
+// Header-only typed stack for callers that know the element type and the wanted
+// protection at compile time:
+//
+//     Stack<double, ReleaseStackPolicy_t> fast;
+//     Stack<Point,  DebugStackPolicy_t>   checked;
+//
+// A policy bundles four independent parts (canary, hash, lock, log). Each part is
+// an empty type when it is switched off, the stack inherits from all of them, so
+// a disabled part takes no space and its hooks inline to nothing. Elements must
+// be trivially copyable, since the buffer grows with realloc like StackResize.
+//
+// The id-based C API in stack.h stays as it is: it adds the registry, the
+// lock-free/work-stealing modes and the storage backends on top of a fixed
+// StackElem_t and is still configured with the protection macros.
+
+// ---------------------------------------------------------------- canary policies
+
+struct StackNoCanary_t
+{
+    static const size_t CANARY_SIZE = 0;
+
+    void Arm    (char* block, size_t bytes)       noexcept { (void) block; (void) bytes; }
+
+    bool Damaged(const char* block, size_t bytes) const noexcept { (void) block; (void) bytes; return false; }
+};
+
+// The element buffer is framed by one Canary_t on each side.
+
+struct StackDataCanary_t
+{
+    static const size_t CANARY_SIZE = sizeof(Canary_t);
+
+    void Arm(char* block, size_t bytes) noexcept
+    {
+        Canary_t canary = CANARY;
+
+        memcpy(block,                       &canary, sizeof(Canary_t));
+
+        memcpy(block + bytes - CANARY_SIZE, &canary, sizeof(Canary_t));
+    }
+
+    bool Damaged(const char* block, size_t bytes) const noexcept
+    {
+        Canary_t left  = 0;
+
+        Canary_t right = 0;
+
+        memcpy(&left,  block,                       sizeof(Canary_t));
+
+        memcpy(&right, block + bytes - CANARY_SIZE, sizeof(Canary_t));
+
+        return left != CANARY || right != CANARY;
+    }
+};
+
+// ---------------------------------------------------------------- hash policies
+
+template <class T>
+static inline uint64_t StackElemWord(const T& value) noexcept
+{
+    uint64_t word = 0;
+
+    if (sizeof(T) <= sizeof(uint64_t))
+    {
+        memcpy(&word, &value, sizeof(T));
+
+        return word;
+    }
+
+    const char* bytes = (const char*) &value;
+
+    for (size_t offset = 0; offset < sizeof(T); offset += sizeof(uint64_t))
+    {
+        uint64_t part = 0;
+
+        memcpy(&part, bytes + offset, sizeof(T) - offset < sizeof(uint64_t) ? sizeof(T) - offset : sizeof(uint64_t));
+
+        word = DataElemHash(word ^ part, offset);
+    }
+
+    return word;
+}
+
+struct StackNoHash_t
+{
+    template <class T> void Add    (const T& value, size_t pos) noexcept { (void) value; (void) pos; }
+
+    template <class T> void Remove (const T& value, size_t pos) noexcept { (void) value; (void) pos; }
+
+    template <class T> bool Damaged(const T* data,  size_t size) const noexcept { (void) data; (void) size; return false; }
+};
+
+// Same position-mixed sum as Stack_t::DataHash: O(1) per push/pop, Damaged walks
+// the live prefix.
+
+struct StackDataHash_t
+{
+    uint64_t DataHash = 5831;
+
+    template <class T> void Add(const T& value, size_t pos) noexcept
+    {
+        DataHash += DataElemHash(StackElemWord(value), pos);
+    }
+
+    template <class T> void Remove(const T& value, size_t pos) noexcept
+    {
+        DataHash -= DataElemHash(StackElemWord(value), pos);
+    }
+
+    template <class T> bool Damaged(const T* data, size_t size) const noexcept
+    {
+        uint64_t hash = 5831;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            hash += DataElemHash(StackElemWord(data[i]), i);
+        }
+
+        return hash != DataHash;
+    }
+};
+
+// ---------------------------------------------------------------- lock policies
+
+struct StackNoLock_t
+{
+    void Lock  () noexcept {}
+
+    void Unlock() noexcept {}
+};
+
+struct StackMutexLock_t
+{
+    pthread_mutex_t mutex;
+
+    StackMutexLock_t () noexcept { pthread_mutex_init(&mutex, NULL); }
+
+    ~StackMutexLock_t() { pthread_mutex_destroy(&mutex); }
+
+    void Lock  () noexcept { pthread_mutex_lock  (&mutex); }
+
+    void Unlock() noexcept { pthread_mutex_unlock(&mutex); }
+};
+
+// ---------------------------------------------------------------- log policies
+
+struct StackNoLog_t
+{
+    void Log(const char* op, const void* stack, size_t size, size_t capacity) noexcept
+    {
+        (void) op; (void) stack; (void) size; (void) capacity;
+    }
+};
+
+// fprintf is a cancellation point and so is not nothrow: a noexcept Log calling it
+// directly would need a terminate handler, and so libstdc++, in C builds. The line
+// is written with cancellation disabled instead, which makes the nothrow promise
+// below true; noinline keeps the fprintf call out of the noexcept callers.
+
+__attribute__((noinline, nothrow))
+static inline void StackLogLine(FILE* file, const char* op, const void* stack, size_t size, size_t capacity)
+{
+    int state = 0;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+    fprintf(file, "Stack[%p] %s: size = %lu, capacity = %lu\n", stack, op, size, capacity);
+
+    pthread_setcancelstate(state, nullptr);
+}
+
+struct StackFileLog_t
+{
+    FILE* LogFile = stderr;
+
+    void Log(const char* op, const void* stack, size_t size, size_t capacity) noexcept
+    {
+        StackLogLine(LogFile, op, stack, size, capacity);
+    }
+};
+
+// ---------------------------------------------------------------- policies
+
+template <class CanaryPolicy, class HashPolicy, class LockPolicy, class LogPolicy>
+struct StackPolicy_t
+{
+    typedef CanaryPolicy Canary;
+    typedef HashPolicy   Hash;
+    typedef LockPolicy   Lock;
+    typedef LogPolicy    Log;
+};
+
+typedef StackPolicy_t<StackNoCanary_t,   StackNoHash_t,   StackNoLock_t,    StackNoLog_t>   ReleaseStackPolicy_t;
+
+typedef StackPolicy_t<StackDataCanary_t, StackDataHash_t, StackNoLock_t,    StackNoLog_t>   CheckedStackPolicy_t;
+
+typedef StackPolicy_t<StackNoCanary_t,   StackNoHash_t,   StackMutexLock_t, StackNoLog_t>   ThreadStackPolicy_t;
+
+typedef StackPolicy_t<StackDataCanary_t, StackDataHash_t, StackMutexLock_t, StackFileLog_t> DebugStackPolicy_t;
+
+// ---------------------------------------------------------------- stack
+
+template <class T, class Policy = ReleaseStackPolicy_t>
+class Stack : private Policy::Canary, private Policy::Hash, private Policy::Lock, private Policy::Log
+{
+    static_assert(__is_trivially_copyable(T), "Stack<T> grows with realloc, T must be trivially copyable");
+
+    typedef typename Policy::Canary CanaryPart;
+    typedef typename Policy::Hash   HashPart;
+    typedef typename Policy::Lock   LockPart;
+    typedef typename Policy::Log    LogPart;
+
+    static const size_t CANARY_SIZE = CanaryPart::CANARY_SIZE;
+
+    static const size_t DATA_OFFSET = CANARY_SIZE && alignof(T) > CANARY_SIZE ? alignof(T) : CANARY_SIZE;
+
+    char*  block    = nullptr;
+    T*     data     = nullptr;
+    size_t size     = 0;
+    size_t capacity = 0;
+
+  public:
+
+    // A failed allocation leaves the stack without a block: Push/Pop/Verify then
+    // fail with INVALID_DATA_POINTER instead of touching it.
+
+    explicit Stack(size_t InitCapacity = MIN_STACK_SIZE) noexcept
+    {
+        Resize(InitCapacity < MIN_STACK_SIZE ? MIN_STACK_SIZE : InitCapacity);
+    }
+
+    ~Stack()
+    {
+        free(block);
+    }
+
+    Stack(const Stack&)            = delete;
+
+    Stack& operator=(const Stack&) = delete;
+
+    StackReturnCode Push(const T& value) noexcept
+    {
+        LockPart::Lock();
+
+        if (__builtin_expect(!block, 0))
+        {
+            err |= INVALID_DATA_POINTER;
+
+            LockPart::Unlock();
+
+            return FAILED;
+        }
+
+        if (Damaged())
+        {
+            LockPart::Unlock();
+
+            return STACK_DAMAGED;
+        }
+
+        if (__builtin_expect(size >= capacity, 0) && Resize(capacity * 2 > MIN_STACK_SIZE ? capacity * 2 : MIN_STACK_SIZE) == FAILED)
+        {
+            LockPart::Unlock();
+
+            return FAILED;
+        }
+
+        data[size] = value;
+
+        HashPart::Add(value, size);
+
+        size++;
+
+        LogPart::Log("Push", this, size, capacity);
+
+        LockPart::Unlock();
+
+        return EXECUTED;
+    }
+
+    StackReturnCode Pop(T* value) noexcept
+    {
+        LockPart::Lock();
+
+        if (__builtin_expect(!block, 0))
+        {
+            err |= INVALID_DATA_POINTER;
+
+            LockPart::Unlock();
+
+            return FAILED;
+        }
+
+        if (Damaged())
+        {
+            LockPart::Unlock();
+
+            return STACK_DAMAGED;
+        }
+
+        if (__builtin_expect(size == 0, 0))
+        {
+            err |= STACK_UNDERFLOW;
+
+            LockPart::Unlock();
+
+            return FAILED;
+        }
+
+        size--;
+
+        *value = data[size];
+
+        HashPart::Remove(*value, size);
+
+        LogPart::Log("Pop", this, size, capacity);
+
+        LockPart::Unlock();
+
+        return EXECUTED;
+    }
+
+    // Full check, including the data hash walk that Push/Pop skip.
+
+    StackReturnCode Verify() noexcept
+    {
+        LockPart::Lock();
+
+        if (!block)
+        {
+            err |= INVALID_DATA_POINTER;
+
+            LockPart::Unlock();
+
+            return FAILED;
+        }
+
+        bool damaged = Damaged() || HashPart::Damaged(data, size);
+
+        if (damaged)
+        {
+            err |= DAMAGED_STACK_ERR;
+        }
+
+        LockPart::Unlock();
+
+        return damaged ? STACK_DAMAGED : STACK_NOT_DAMAGED;
+    }
+
+    size_t Size    () const noexcept { return size;     }
+
+    size_t Capacity() const noexcept { return capacity; }
+
+  private:
+
+    bool Damaged() const noexcept
+    {
+        if (CanaryPart::Damaged(block, BlockSize(capacity)))
+        {
+            err |= INVALID_DATA_CANARY;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    static size_t BlockSize(size_t elems) noexcept
+    {
+        return DATA_OFFSET + elems * sizeof(T) + CANARY_SIZE;
+    }
+
+    __attribute__((noinline)) StackReturnCode Resize(size_t NewCapacity) noexcept
+    {
+        if (NewCapacity > (size_t) MAX_MAPPED_STACK_SIZE)
+        {
+            err |= STACK_OVERFLOW;
+
+            return FAILED;
+        }
+
+        char* NewBlock = (char*) realloc(block, BlockSize(NewCapacity));
+
+        if (!NewBlock)
+        {
+            err |= INVALID_DATA_POINTER;
+
+            return FAILED;
+        }
+
+        block    = NewBlock;
+
+        data     = (T*) (block + DATA_OFFSET);
+
+        capacity = NewCapacity;
+
+        CanaryPart::Arm(block, BlockSize(capacity));
+
+        return EXECUTED;
+    }
+};
+
+#endif // STACK_HPP__
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stack.h>
+
+#ifndef WORKSTEAL_H__
+#define WORKSTEAL_H__
+
+struct WorkStealDeque_t;
+
+WorkStealDeque_t*        WorkStealCtor       (uint64_t capacity, FILE* MemoryLogFile);
+
+StackReturnCode          WorkStealPush       (WorkStealDeque_t* deque, StackElem_t value);
+
+StackReturnCode          WorkStealPop        (WorkStealDeque_t* deque, StackElem_t* value);
+
+StackReturnCode          WorkStealSteal      (WorkStealDeque_t* deque, StackElem_t* value);
+
+StackReturnCode          WorkStealDtor       (WorkStealDeque_t* deque);
+
+#endif // WORKSTEAL_H__
@@ -1,81 +1,1406 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 
 #include "allocation.h"
 
+// Size-class pool behind log_malloc/log_calloc/log_realloc/log_free.
+//
+// Every block starts with a 16-byte header holding its size class. Classes are
+// powers of two from 64 bytes to 64 KiB, larger requests go straight to malloc.
+// Each thread caches up to POOL_CACHE_LIMIT free blocks per class and trades
+// them with the shared per-class lists POOL_BATCH at a time, so a StackCtor /
+// StackDtor pair normally takes no lock and makes no malloc call.
+//
+// The log_* wrappers also feed an allocation tracker: a fixed open-addressing
+// table of live blocks keyed by pointer, with live/peak bytes and event counts.
+// Their memory log lines are buffered and written TRACE_BATCH at a time instead
+// of one fprintf per call; alloc_trace_flush writes what is pending.
+
+const int    POOL_MIN_SHIFT   = 6;
+
+const int    POOL_MAX_SHIFT   = 16;
+
+const int    POOL_CLASSES     = POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1;
+
+const int    POOL_LARGE       = POOL_CLASSES;
+
+const int    POOL_CACHE_LIMIT = 64;
+
+const int    POOL_BATCH       = 32;
+
+const size_t POOL_SLAB_SIZE   = 256 * 1024;
+
+const uint64_t FILE_MAGIC     = 0x4B43415453445453; // "STDSTACK"
+
+const uint32_t FILE_VERSION   = 2; // 2: CRC32C struct hash
+
+const size_t TRACE_SLOTS      = 1 << 14;
+
+const size_t TRACE_BATCH      = 128;
+
+struct PoolHeader_t
+{
+    uint64_t     SizeClass;
+    uint64_t     size;
+};
+
+struct MappedHeader_t
+{
+    uint64_t     reserved;
+    uint64_t     committed;
+    int64_t      fd;          // memfd behind the block, -1 for anonymous memory
+    uint64_t     shared;      // MAP_SHARED view, the only one of its memfd
+};
+
+// On-disk header of a file-backed block, followed by the block itself. fd and
+// reserved describe the current mapping and are rewritten by every file_open.
+
+struct FileHeader_t
+{
+    uint64_t     magic;
+    uint32_t     version;
+    int32_t      fd;
+    uint64_t     layout;      // caller's format word, must match on open
+    uint64_t     reserved;
+    uint64_t     committed;   // file length
+};
+
+struct GuardedHeader_t
+{
+    uint64_t     mapped;
+    uint64_t     size;
+};
+
+typedef enum AllocEventKinds
+{
+    ALLOC_EVENT_CALLOC  = 0,
+    ALLOC_EVENT_REALLOC = 1,
+    ALLOC_EVENT_FREE    = 2,
+    ALLOC_EVENT_MALLOC  = 3,
+} AllocEventKind;
+
+struct AllocEvent_t
+{
+    AllocEventKind kind;
+    const void*    ptr;       // realloc/free argument
+    const void*    NewPtr;    // malloc/calloc/realloc result
+    uint64_t       nMemb;
+    uint64_t       size;
+};
+
+struct TraceEntry_t
+{
+    const void*    ptr;
+    uint64_t       size;
+};
+
+struct PoolBlock_t
+{
+    PoolBlock_t* next;
+};
+
+struct PoolClass_t
+{
+    pthread_mutex_t mutex;
+    PoolBlock_t*    head;
+};
+
+struct PoolCache_t
+{
+    PoolBlock_t* heads [POOL_CLASSES];
+    int          counts[POOL_CLASSES];
+};
+
+static PoolClass_t              POOL[POOL_CLASSES] = {};
+
+static pthread_once_t           PoolOnce = PTHREAD_ONCE_INIT;
+
+static pthread_key_t            PoolCacheKey;
+
+static __thread PoolCache_t     PoolCache = {};
+
+static __thread bool            PoolCacheRegistered = false; // PoolCacheKey set for this thread
+
+static TraceEntry_t             TraceTable [TRACE_SLOTS] = {};
+
+static AllocEvent_t             TraceEvents[TRACE_BATCH] = {};
+
+static size_t                   TraceCount = 0;
+
+static FILE*                    TraceFile  = nullptr;
+
+static AllocStats_t             TraceStats = {};
+
+static pthread_mutex_t          TraceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void         PoolInit        ();
+
+static void         PoolCacheFlush  (void* cache);
+
+static inline void  PoolCacheRegister();
+
+static int          PoolSizeClass   (size_t SizeInBytes);
+
+static void*        PoolAlloc       (size_t SizeInBytes);
+
+static PoolBlock_t* PoolRefill      (int SizeClass);
+
+static void         PoolRelease     (PoolCache_t* cache, int SizeClass, int count);
+
+static size_t       PageAligned     (size_t SizeInBytes);
+
+static void*        FileMap         (int fd, size_t ReserveInBytes, size_t committed);
+
+static void*        MappedView      (int fd, size_t reserved, size_t committed, int flags);
+
+static int          MappedFreeze    (MappedHeader_t* header);
+
+static void         TraceRecord     (FILE* MemoryLogFile, const AllocEvent_t* event);
+
+static void         TraceAppend     (FILE* MemoryLogFile, const AllocEvent_t* event);
+
+static void         TraceUpdate     (const AllocEvent_t* event);
+
+static void         TraceInsert     (const void* ptr, uint64_t size);
+
+static void         TraceRemove     (const void* ptr);
+
+static size_t       TraceSlot       (const void* ptr);
+
+static void         TraceFlush      ();
+
+void* log_malloc(FILE* MemoryLogFile, size_t SizeInBytes)
+{
+    void* ptr = pool_malloc(SizeInBytes);
+
+    AllocEvent_t event = {ALLOC_EVENT_MALLOC, nullptr, ptr, 1, SizeInBytes};
+
+    TraceRecord(MemoryLogFile, &event);
+
+    return ptr;
+}
+
 void* log_calloc(FILE* MemoryLogFile, size_t nMemb, size_t size)
 {
-    void* ptr = calloc(nMemb, size);
+    void* ptr = pool_calloc(nMemb, size);
+
+    AllocEvent_t event = {ALLOC_EVENT_CALLOC, nullptr, ptr, nMemb, size};
+
+    TraceRecord(MemoryLogFile, &event);
+
+    return ptr;
+}
+
+// A block handed back to the pool may be handed out again at once, so realloc
+// and free release it under TraceMutex: the new owner's CALLOC is recorded only
+// after the entry of the old one is gone.
+
+void* log_realloc(FILE* MemoryLogFile, void* ptr, size_t SizeInBytes)
+{
+    pthread_mutex_lock(&TraceMutex);
+
+    void* NewPtr = pool_realloc(ptr, SizeInBytes);
+
+    AllocEvent_t event = {ALLOC_EVENT_REALLOC, ptr, NewPtr, 1, SizeInBytes};
+
+    TraceAppend(MemoryLogFile, &event);
+
+    pthread_mutex_unlock(&TraceMutex);
+
+    return NewPtr;
+}
+
+void* log_free(FILE* MemoryLogFile, void* ptr)
+{
+    pthread_mutex_lock(&TraceMutex);
+
+    pool_free(ptr);
+
+    AllocEvent_t event = {ALLOC_EVENT_FREE, ptr, nullptr, 0, 0};
+
+    TraceAppend(MemoryLogFile, &event);
+
+    pthread_mutex_unlock(&TraceMutex);
+
+    return ptr;
+}
+
+// Structures with alignas members need more than the 16 bytes pool blocks are
+// aligned to, so they come from aligned_calloc and are traced the same way.
+
+void* log_aligned_calloc(FILE* MemoryLogFile, size_t alignment, size_t SizeInBytes)
+{
+    void* ptr = aligned_calloc(alignment, SizeInBytes);
+
+    AllocEvent_t event = {ALLOC_EVENT_CALLOC, nullptr, ptr, 1, SizeInBytes};
+
+    TraceRecord(MemoryLogFile, &event);
+
+    return ptr;
+}
+
+void log_aligned_free(FILE* MemoryLogFile, void* ptr)
+{
+    AllocEvent_t event = {ALLOC_EVENT_FREE, ptr, nullptr, 0, 0};
+
+    pthread_mutex_lock(&TraceMutex);
+
+    aligned_free(ptr);
+
+    TraceAppend(MemoryLogFile, &event);
+
+    pthread_mutex_unlock(&TraceMutex);
+}
+
+void alloc_trace_stats(AllocStats_t* stats)
+{
+    pthread_mutex_lock(&TraceMutex);
+
+    *stats = TraceStats;
+
+    pthread_mutex_unlock(&TraceMutex);
+}
+
+void alloc_trace_flush()
+{
+    pthread_mutex_lock(&TraceMutex);
+
+    TraceFlush();
+
+    pthread_mutex_unlock(&TraceMutex);
+}
+
+// Summary and every block still in the table. Called with all stacks destroyed,
+// each listed block is a leak.
+
+void alloc_trace_report(FILE* fp)
+{
+    if (!fp)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&TraceMutex);
+
+    TraceFlush();
+
+    ON_HTML(fprintf(fp, "<p>"
+                        "Allocation summary<br>"
+                        "Live bytes: <em style=\"color:Red\">%lu</em>, peak: <em style=\"color:Red\">%lu</em><br>"
+                        "Allocs: %lu, reallocs: %lu, frees: %lu, untracked: %lu<br>"
+                        "Unfreed blocks: <em style=\"color:Red\">%lu</em><br>",
+                        TraceStats.LiveBytes, TraceStats.PeakBytes, TraceStats.allocs,
+                        TraceStats.reallocs, TraceStats.frees, TraceStats.untracked, TraceStats.LiveBlocks));
+
+    ON_LOG( fprintf(fp, "Allocation summary\n"
+                        "Live bytes: %lu, peak: %lu\n"
+                        "Allocs: %lu, reallocs: %lu, frees: %lu, untracked: %lu\n"
+                        "Unfreed blocks: %lu\n",
+                        TraceStats.LiveBytes, TraceStats.PeakBytes, TraceStats.allocs,
+                        TraceStats.reallocs, TraceStats.frees, TraceStats.untracked, TraceStats.LiveBlocks));
+
+    for (size_t i = 0; i < TRACE_SLOTS; i++)
+    {
+        if (TraceTable[i].ptr)
+        {
+            ON_HTML(fprintf(fp, "%p: %lu bytes<br>", TraceTable[i].ptr, TraceTable[i].size));
+
+            ON_LOG( fprintf(fp, "%p: %lu bytes\n",  TraceTable[i].ptr, TraceTable[i].size));
+        }
+    }
+
+    ON_HTML(fprintf(fp, "----------------------<br></p>"));
+
+    ON_LOG( fprintf(fp, "----------------------\n"));
+
+    pthread_mutex_unlock(&TraceMutex);
+}
+
+void* pool_malloc(size_t SizeInBytes)
+{
+    return PoolAlloc(SizeInBytes);
+}
+
+void* pool_calloc(size_t nMemb, size_t size)
+{
+    if (size && nMemb > SIZE_MAX / size)
+    {
+        return nullptr;
+    }
+
+    void* ptr = PoolAlloc(nMemb * size);
+
+    if (ptr)
+    {
+        memset(ptr, 0, nMemb * size);
+    }
+
+    return ptr;
+}
+
+void* pool_realloc(void* ptr, size_t SizeInBytes)
+{
+    if (!ptr)
+    {
+        return PoolAlloc(SizeInBytes);
+    }
+
+    PoolHeader_t* header = (PoolHeader_t*) ptr - 1;
+
+    if (header->SizeClass == POOL_LARGE && PoolSizeClass(SizeInBytes) == POOL_LARGE)
+    {
+        header = (PoolHeader_t*) realloc(header, sizeof(PoolHeader_t) + SizeInBytes);
+
+        if (!header)
+        {
+            return nullptr;
+        }
+
+        header->size = SizeInBytes;
+
+        return header + 1;
+    }
+
+    if (header->SizeClass != POOL_LARGE && PoolSizeClass(SizeInBytes) == (int) header->SizeClass)
+    {
+        header->size = SizeInBytes; // still fits, keep the block
+
+        return ptr;
+    }
+
+    void* NewPtr = PoolAlloc(SizeInBytes);
+
+    if (!NewPtr)
+    {
+        return nullptr;
+    }
+
+    memcpy(NewPtr, ptr, header->size < SizeInBytes ? header->size : SizeInBytes);
+
+    pool_free(ptr);
+
+    return NewPtr;
+}
+
+void pool_free(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    PoolHeader_t* header = (PoolHeader_t*) ptr - 1;
+
+    int SizeClass = (int) header->SizeClass;
+
+    if (SizeClass == POOL_LARGE)
+    {
+        free(header);
+
+        return;
+    }
+
+    PoolCacheRegister(); // a thread that only frees must flush its cache on exit too
+
+    PoolBlock_t* block = (PoolBlock_t*) header;
+
+    block->next = PoolCache.heads[SizeClass];
+
+    PoolCache.heads[SizeClass] = block;
+
+    if (++PoolCache.counts[SizeClass] > POOL_CACHE_LIMIT)
+    {
+        PoolRelease(&PoolCache, SizeClass, POOL_BATCH);
+    }
+}
+
+void PoolInit()
+{
+    for (int i = 0; i < POOL_CLASSES; i++)
+    {
+        pthread_mutex_init(&POOL[i].mutex, NULL);
+    }
+
+    pthread_key_create(&PoolCacheKey, PoolCacheFlush);
+}
+
+void PoolCacheFlush(void* cache)
+{
+    for (int i = 0; i < POOL_CLASSES; i++)
+    {
+        PoolRelease((PoolCache_t*) cache, i, ((PoolCache_t*) cache)->counts[i]);
+    }
+
+    PoolCacheRegistered = false; // a later thread-exit destructor that frees registers again
+}
+
+// Sets PoolCacheKey on the first pool_alloc or pool_free of a thread, so the
+// thread's cached blocks go back to the shared lists when it exits.
+
+void PoolCacheRegister()
+{
+    if (!PoolCacheRegistered)
+    {
+        pthread_once(&PoolOnce, PoolInit);
+
+        pthread_setspecific(PoolCacheKey, &PoolCache);
+
+        PoolCacheRegistered = true;
+    }
+}
+
+int PoolSizeClass(size_t SizeInBytes)
+{
+    size_t total = sizeof(PoolHeader_t) + SizeInBytes;
+
+    for (int i = 0; i < POOL_CLASSES; i++)
+    {
+        if (total <= ((size_t) 1 << (i + POOL_MIN_SHIFT)))
+        {
+            return i;
+        }
+    }
+
+    return POOL_LARGE;
+}
+
+void* PoolAlloc(size_t SizeInBytes)
+{
+    int SizeClass = PoolSizeClass(SizeInBytes);
+
+    PoolHeader_t* header = nullptr;
+
+    if (SizeClass == POOL_LARGE)
+    {
+        header = (PoolHeader_t*) malloc(sizeof(PoolHeader_t) + SizeInBytes);
+    }
+    else
+    {
+        PoolBlock_t* block = PoolCache.heads[SizeClass];
+
+        if (!block)
+        {
+            block = PoolRefill(SizeClass);
+        }
+
+        if (block)
+        {
+            PoolCache.heads[SizeClass] = block->next;
+
+            PoolCache.counts[SizeClass]--;
+        }
+
+        header = (PoolHeader_t*) block;
+    }
+
+    if (!header)
+    {
+        return nullptr;
+    }
+
+    header->SizeClass = (uint64_t) SizeClass;
+
+    header->size      = SizeInBytes;
+
+    return header + 1;
+}
+
+// Moves up to POOL_BATCH blocks from the shared list into this thread's cache,
+// carving a fresh slab when the shared list is empty. Returns the new cache head.
+
+PoolBlock_t* PoolRefill(int SizeClass)
+{
+    PoolCacheRegister();
+
+    PoolClass_t* pool = &POOL[SizeClass];
+
+    size_t BlockSize = (size_t) 1 << (SizeClass + POOL_MIN_SHIFT);
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (!pool->head)
+    {
+        size_t SlabSize = BlockSize > POOL_SLAB_SIZE ? BlockSize : POOL_SLAB_SIZE;
+
+        char* slab = (char*) malloc(SlabSize);
+
+        for (size_t offset = 0; slab && offset + BlockSize <= SlabSize; offset += BlockSize)
+        {
+            PoolBlock_t* block = (PoolBlock_t*) (slab + offset);
+
+            block->next = pool->head;
+
+            pool->head  = block;
+        }
+    }
+
+    for (int i = 0; i < POOL_BATCH && pool->head; i++)
+    {
+        PoolBlock_t* block = pool->head;
+
+        pool->head = block->next;
+
+        block->next = PoolCache.heads[SizeClass];
+
+        PoolCache.heads[SizeClass] = block;
+
+        PoolCache.counts[SizeClass]++;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return PoolCache.heads[SizeClass];
+}
+
+void PoolRelease(PoolCache_t* cache, int SizeClass, int count)
+{
+    pthread_once(&PoolOnce, PoolInit);
+
+    PoolClass_t* pool = &POOL[SizeClass];
+
+    pthread_mutex_lock(&pool->mutex);
+
+    for (int i = 0; i < count && cache->heads[SizeClass]; i++)
+    {
+        PoolBlock_t* block = cache->heads[SizeClass];
+
+        cache->heads[SizeClass] = block->next;
+
+        cache->counts[SizeClass]--;
+
+        block->next = pool->head;
+
+        pool->head  = block;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Large stacks: the whole address range a stack may ever need is reserved up
+// front with PROT_NONE, and pages are committed or given back at the end of the
+// block, so the block never moves and resizing costs only the pages it changes.
+//
+// The range is a MAP_SHARED view of a memfd, so mapped_clone can share the pages
+// instead of copying them: it turns the block into a MAP_PRIVATE view of the same
+// memfd, which nothing writes to any more, and maps the copy the same way. Both
+// then copy a page on their first write to it. A block that is already private
+// first writes its committed pages out to a new memfd, once per clone. Without
+// memfd_create the range is anonymous memory and mapped_clone fails.
+
+void* mapped_alloc(size_t ReserveInBytes, size_t SizeInBytes)
+{
+    size_t reserved  = PageAligned(sizeof(MappedHeader_t) + ReserveInBytes);
+
+    size_t committed = PageAligned(sizeof(MappedHeader_t) + SizeInBytes);
+
+    if (committed > reserved)
+    {
+        return nullptr;
+    }
+
+    int fd = memfd_create("stack", MFD_CLOEXEC);
+
+    if (fd >= 0 && ftruncate(fd, (off_t) reserved) != 0)
+    {
+        close(fd);
+
+        fd = -1;
+    }
+
+    void* base = MappedView(fd, reserved, committed, fd >= 0 ? MAP_SHARED : MAP_PRIVATE);
+
+    if (!base)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return nullptr;
+    }
+
+    MappedHeader_t* header = (MappedHeader_t*) base;
+
+    header->reserved  = reserved;
+
+    header->committed = committed;
+
+    header->fd        = fd;
+
+    header->shared    = fd >= 0;
+
+    return header + 1;
+}
+
+void* mapped_realloc(void* ptr, size_t SizeInBytes)
+{
+    MappedHeader_t* header = (MappedHeader_t*) ptr - 1;
+
+    size_t committed = PageAligned(sizeof(MappedHeader_t) + SizeInBytes);
+
+    if (committed > header->reserved)
+    {
+        return nullptr;
+    }
+
+    char* base = (char*) header;
+
+    if (committed > header->committed)
+    {
+        if (mprotect(base + header->committed, committed - header->committed, PROT_READ | PROT_WRITE) != 0)
+        {
+            return nullptr;
+        }
+    }
+    else if (committed < header->committed)
+    {
+        if (header->shared) // the pages are in the memfd, not in the mapping
+        {
+            fallocate((int) header->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      (off_t) committed, (off_t) (header->committed - committed));
+        }
+
+        madvise (base + committed, header->committed - committed, MADV_DONTNEED);
+
+        mprotect(base + committed, header->committed - committed, PROT_NONE);
+    }
+
+    header->committed = committed;
+
+    return ptr;
+}
+
+void* mapped_clone(void* ptr)
+{
+    MappedHeader_t* header = (MappedHeader_t*) ptr - 1;
+
+    if (header->fd < 0 || MappedFreeze(header) != 0)
+    {
+        return nullptr;
+    }
+
+    int fd = fcntl((int) header->fd, F_DUPFD_CLOEXEC, 0);
+
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    void* base = MappedView(fd, header->reserved, header->committed, MAP_PRIVATE);
+
+    if (!base)
+    {
+        close(fd);
+
+        return nullptr;
+    }
+
+    MappedHeader_t* copy = (MappedHeader_t*) base;
+
+    copy->fd     = fd;
+
+    copy->shared = false; // the memfd still says what the block said before it froze
+
+    return copy + 1;
+}
+
+void mapped_free(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    MappedHeader_t* header = (MappedHeader_t*) ptr - 1;
+
+    int fd = (int) header->fd;
+
+    munmap(header, header->reserved);
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// Maps reserved bytes of fd (anonymous memory for -1) with PROT_NONE and commits
+// the first committed of them.
+
+void* MappedView(int fd, size_t reserved, size_t committed, int flags)
+{
+    flags |= MAP_NORESERVE | (fd < 0 ? MAP_ANONYMOUS : 0);
+
+    char* view = (char*) mmap(NULL, reserved, PROT_NONE, flags, fd, 0);
+
+    if (view == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    if (mprotect(view, committed, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(view, reserved);
+
+        return nullptr;
+    }
+
+    return view;
+}
+
+// Makes the memfd behind header read-only for everyone, so private views of it can
+// share its pages: a shared block becomes a private view of its own memfd, which
+// holds exactly what the block does. A private block may have copied pages, so it
+// is written out to a new memfd first.
+//
+// The new view is mapped elsewhere and moved over the block with mremap, which
+// replaces a mapping without a gap, so the block keeps its address and a failure
+// leaves it as it was. mremap moves one protection at a time: the committed part
+// goes first, the PROT_NONE rest after it. If only the rest fails to move, it
+// stays a shared view, which is harmless: StackResize poisons grown slots before
+// they are read, so clones never see what the block writes there.
+
+int MappedFreeze(MappedHeader_t* header)
+{
+    size_t reserved  = header->reserved;
+
+    size_t committed = header->committed;
+
+    int    fd        = (int) header->fd;
+
+    if (!header->shared)
+    {
+        fd = memfd_create("stack", MFD_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        size_t written = ftruncate(fd, (off_t) reserved) == 0 ? 0 : committed + 1;
+
+        while (written < committed)
+        {
+            ssize_t chunk = pwrite(fd, (char*) header + written, committed - written, (off_t) written);
+
+            written = chunk > 0 ? written + (size_t) chunk : committed + 1;
+        }
+
+        if (written != committed)
+        {
+            close(fd);
+
+            return -1;
+        }
+    }
+
+    char* view = (char*) MappedView(fd, reserved, committed, MAP_PRIVATE);
+
+    char* base = (char*) header;
+
+    if (!view || mremap(view, committed, committed, MREMAP_MAYMOVE | MREMAP_FIXED, base) == MAP_FAILED)
+    {
+        if (view)
+        {
+            munmap(view, reserved);
+        }
+
+        if (fd != header->fd)
+        {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    if (reserved > committed &&
+        mremap(view + committed, reserved - committed, reserved - committed, MREMAP_MAYMOVE | MREMAP_FIXED,
+               base + committed) == MAP_FAILED)
+    {
+        munmap(view + committed, reserved - committed);
+    }
+
+    if (fd != header->fd)
+    {
+        close((int) header->fd);
+    }
+
+    header->fd     = fd;
+
+    header->shared = false;
+
+    return 0;
+}
+
+// File-backed blocks: mapped like the blocks above, the reservation stays
+// PROT_NONE and the committed part is a MAP_SHARED view of the file, so the block
+// never moves and whatever is written to it is in the file. Reopening maps the
+// file back at a new address; nothing in the block is read or copied.
+//
+// The file is flock'ed from file_alloc/file_open until file_free, so one stack
+// file is mapped by one stack at a time, in this process or any other. file_alloc
+// only takes a new or empty file: it never truncates one that already holds
+// anything, a stack or not.
+
+void* file_alloc(const char* path, uint64_t layout, size_t ReserveInBytes, size_t SizeInBytes)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
 
-    if (MemoryLogFile)
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st = {};
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0 || st.st_size != 0)
+    {
+        close(fd);
+
+        return nullptr;
+    }
+
+    size_t committed = PageAligned(sizeof(FileHeader_t) + SizeInBytes);
+
+    if (ftruncate(fd, (off_t) committed) != 0)
+    {
+        close(fd);
+
+        return nullptr;
+    }
+
+    FileHeader_t* header = (FileHeader_t*) FileMap(fd, ReserveInBytes, committed);
+
+    if (!header)
+    {
+        close(fd);
+
+        return nullptr;
+    }
+
+    header->magic     = FILE_MAGIC;
+
+    header->version   = FILE_VERSION;
+
+    header->layout    = layout;
+
+    header->committed = committed;
+
+    return header + 1;
+}
+
+void* file_open(const char* path, uint64_t layout, size_t ReserveInBytes)
+{
+    int fd = open(path, O_RDWR);
+
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    FileHeader_t stored = {};
+
+    struct stat st = {};
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 ||
+        pread(fd, &stored, sizeof(FileHeader_t), 0) != (ssize_t) sizeof(FileHeader_t) ||
+        fstat(fd, &st) != 0 || stored.magic != FILE_MAGIC || stored.version != FILE_VERSION ||
+        stored.layout != layout || stored.committed != (uint64_t) st.st_size)
+    {
+        close(fd);
+
+        return nullptr;
+    }
+
+    FileHeader_t* header = (FileHeader_t*) FileMap(fd, ReserveInBytes, stored.committed);
+
+    if (!header)
     {
-        ON_HTML(fprintf(MemoryLogFile, "<p>"
-                                       "Called calloc                                      <br>"
-                                       "Number of members: <em style=\"color:Red\">%ld</em><br>"
-                                       "Size   of members: <em style=\"color:Red\">%ld</em><br>"
-                                       "Returned: <em style=\"color:Red\">%p</em>          <br>"
-                                       "----------------------<br>"
-                                       "</p>",
-                                       nMemb,
-                                       size,
-                                       ptr));
-
-        ON_LOG( fprintf(MemoryLogFile, "Called calloc         \n"
-                                       "Number of members: %ld\n"
-                                       "Size   of members: %ld\n"
-                                       "Returned: %p          \n"
-                                       "----------------------\n",
-                                       nMemb,
-                                       size,
-                                       ptr));
+        close(fd);
+
+        return nullptr;
+    }
+
+    return header + 1;
+}
+
+void* file_realloc(void* ptr, size_t SizeInBytes)
+{
+    FileHeader_t* header = (FileHeader_t*) ptr - 1;
+
+    size_t committed = PageAligned(sizeof(FileHeader_t) + SizeInBytes);
+
+    if (committed > header->reserved)
+    {
+        return nullptr;
+    }
+
+    char* base = (char*) header;
+
+    if (committed > header->committed)
+    {
+        if (ftruncate(header->fd, (off_t) committed) != 0 ||
+            mmap(base + header->committed, committed - header->committed, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, header->fd, (off_t) header->committed) == MAP_FAILED)
+        {
+            return nullptr;
+        }
+    }
+    else if (committed < header->committed)
+    {
+        mmap(base + committed, header->committed - committed, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+        if (ftruncate(header->fd, (off_t) committed) != 0)
+        {
+            return nullptr;
+        }
     }
 
+    header->committed = committed;
+
     return ptr;
 }
 
-void* log_realloc(FILE* MemoryLogFile, void* ptr, size_t SizeInBytes)
+// Writes the block back and unmaps it; the file keeps it for the next file_open.
+// Closing the descriptor drops the flock.
+
+void file_free(void* ptr)
 {
-    ptr = realloc(ptr, SizeInBytes);
+    if (!ptr)
+    {
+        return;
+    }
 
-    if (MemoryLogFile)
+    FileHeader_t* header = (FileHeader_t*) ptr - 1;
+
+    int fd = header->fd;
+
+    msync(header, header->committed, MS_SYNC);
+
+    munmap(header, header->reserved);
+
+    close(fd);
+}
+
+// Reserves ReserveInBytes past the header and maps the first committed bytes of fd
+// over the start of the reservation.
+
+void* FileMap(int fd, size_t ReserveInBytes, size_t committed)
+{
+    size_t reserved = PageAligned(sizeof(FileHeader_t) + ReserveInBytes);
+
+    if (committed > reserved)
+    {
+        return nullptr;
+    }
+
+    void* base = mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    if (mmap(base, committed, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, reserved);
+
+        return nullptr;
+    }
+
+    FileHeader_t* header = (FileHeader_t*) base;
+
+    header->fd       = fd;
+
+    header->reserved = reserved;
+
+    return header;
+}
+
+// Guarded blocks: every block gets its own mapping with a PROT_NONE page on each
+// side, and the block is pushed against the right one, so the first write past
+// its end faults. The slack in front of the block holds the header.
+//
+//     [guard][slack | header | block][guard]
+
+void* guarded_alloc(size_t SizeInBytes)
+{
+    size_t PageSize = PageAligned(1);
+
+    size_t used     = PageAligned(sizeof(GuardedHeader_t) + SizeInBytes);
+
+    size_t mapped   = used + 2 * PageSize;
+
+    char* base = (char*) mmap(NULL, mapped, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    if (mprotect(base + PageSize, used, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(base, mapped);
+
+        return nullptr;
+    }
+
+    char* block = base + PageSize + used - SizeInBytes;
+
+    GuardedHeader_t* header = (GuardedHeader_t*) block - 1;
+
+    header->mapped = mapped;
+
+    header->size   = SizeInBytes;
+
+    return block;
+}
+
+// The block has to stay against the right guard, so it always moves.
+
+void* guarded_realloc(void* ptr, size_t SizeInBytes)
+{
+    void* NewPtr = guarded_alloc(SizeInBytes);
+
+    if (!NewPtr)
+    {
+        return nullptr;
+    }
+
+    if (ptr)
+    {
+        GuardedHeader_t* header = (GuardedHeader_t*) ptr - 1;
+
+        memcpy(NewPtr, ptr, header->size < SizeInBytes ? header->size : SizeInBytes);
+
+        guarded_free(ptr);
+    }
+
+    return NewPtr;
+}
+
+void guarded_free(void* ptr)
+{
+    if (!ptr)
     {
-        ON_HTML(fprintf(MemoryLogFile, "<p>"
-                                       "Called realloc                                 <br>"
-                                       "Size in bytes: <em style=\"color:Red\">%ld</em><br>"
-                                       "Returned: <em style=\"color:Red\">%p</em>      <br>"
-                                       "----------------------<br>"
-                                       "</p>",
-                                       SizeInBytes,
-                                       ptr));
+        return;
+    }
+
+    GuardedHeader_t* header = (GuardedHeader_t*) ptr - 1;
+
+    size_t PageSize = PageAligned(1);
+
+    char* end = (char*) ptr + header->size;
+
+    munmap(end + PageSize - header->mapped, header->mapped);
+}
+
+// Zeroed block aligned to alignment, a power of two that is a multiple of
+// sizeof(void*). Not pooled: these hold per-stack control structures, not data.
+
+void* aligned_calloc(size_t alignment, size_t SizeInBytes)
+{
+    void* ptr = nullptr;
 
-        ON_LOG(fprintf(MemoryLogFile, "Called realloc        \n"
-                                      "Size in bytes: %ld    \n"
-                                      "Returned: %p          \n"
-                                      "----------------------\n", SizeInBytes, ptr));
+    if (posix_memalign(&ptr, alignment, SizeInBytes ? SizeInBytes : 1) != 0)
+    {
+        return nullptr;
     }
 
+    memset(ptr, 0, SizeInBytes);
+
     return ptr;
 }
 
-void* log_free(FILE* MemoryLogFile, void* ptr)
+void aligned_free(void* ptr)
 {
     free(ptr);
+}
+
+// Which guard of the block at ptr covers address: 1 for the one after the
+// block, -1 for the one before it, 0 for neither.
+
+int guarded_hit(const void* ptr, const void* address)
+{
+    const GuardedHeader_t* header = (const GuardedHeader_t*) ptr - 1;
+
+    size_t PageSize = PageAligned(1);
+
+    const char* end   = (const char*) ptr + header->size;
+
+    const char* base  = end + PageSize - header->mapped;
+
+    const char* fault = (const char*) address;
+
+    if (fault >= end && fault < end + PageSize)
+    {
+        return 1;
+    }
+
+    if (fault >= base && fault < base + PageSize)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t PageAligned(size_t SizeInBytes)
+{
+    static size_t PageSize = 0;
+
+    if (!PageSize)
+    {
+        PageSize = (size_t) sysconf(_SC_PAGESIZE);
+    }
+
+    return (SizeInBytes + PageSize - 1) / PageSize * PageSize;
+}
+
+void TraceRecord(FILE* MemoryLogFile, const AllocEvent_t* event)
+{
+    pthread_mutex_lock(&TraceMutex);
+
+    TraceAppend(MemoryLogFile, event);
+
+    pthread_mutex_unlock(&TraceMutex);
+}
+
+// Caller holds TraceMutex.
+
+void TraceAppend(FILE* MemoryLogFile, const AllocEvent_t* event)
+{
+    TraceUpdate(event);
 
     if (MemoryLogFile)
     {
-        ON_HTML(fprintf(MemoryLogFile, "<p>"
-                                       "Called free                             <br>"
-                                       "Pointer: <em style=\"color:Red\">%p</em><br>"
-                                       "----------------------<br>"
-                                       "</p>",
-                                       ptr));
+        if (TraceFile != MemoryLogFile)
+        {
+            TraceFlush();
+
+            TraceFile = MemoryLogFile;
+        }
 
-        ON_LOG(fprintf(MemoryLogFile, "Called free           \n"
-                                      "Pointer: %p           \n"
-                                      "----------------------\n", ptr));
+        TraceEvents[TraceCount++] = *event;
 
+        if (TraceCount == TRACE_BATCH)
+        {
+            TraceFlush();
+        }
     }
+}
 
-    return ptr;
+void TraceUpdate(const AllocEvent_t* event)
+{
+    uint64_t size = event->nMemb * event->size;
+
+    switch (event->kind)
+    {
+        case ALLOC_EVENT_MALLOC:
+        case ALLOC_EVENT_CALLOC:
+            if (event->NewPtr)
+            {
+                TraceStats.allocs++;
+
+                TraceInsert(event->NewPtr, size);
+            }
+            break;
+
+        case ALLOC_EVENT_REALLOC:
+            if (event->NewPtr) // a failed realloc leaves the old block as it was
+            {
+                if (event->ptr)
+                {
+                    TraceStats.reallocs++;
+
+                    TraceRemove(event->ptr);
+                }
+                else
+                {
+                    TraceStats.allocs++;
+                }
+
+                TraceInsert(event->NewPtr, size);
+            }
+            break;
+
+        case ALLOC_EVENT_FREE:
+            if (event->ptr)
+            {
+                TraceStats.frees++;
+
+                TraceRemove(event->ptr);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void TraceInsert(const void* ptr, uint64_t size)
+{
+    if (TraceStats.LiveBlocks >= TRACE_SLOTS / 4 * 3)
+    {
+        TraceStats.untracked++;
+
+        return;
+    }
+
+    size_t i = TraceSlot(ptr);
+
+    while (TraceTable[i].ptr)
+    {
+        i = (i + 1) % TRACE_SLOTS;
+    }
+
+    TraceTable[i] = {ptr, size};
+
+    TraceStats.LiveBlocks++;
+
+    TraceStats.LiveBytes += size;
+
+    if (TraceStats.LiveBytes > TraceStats.PeakBytes)
+    {
+        TraceStats.PeakBytes = TraceStats.LiveBytes;
+    }
+}
+
+// Linear probing with backward-shift deletion, so the table never fills up with
+// tombstones: every entry after the hole that may move closer to its home does.
+
+void TraceRemove(const void* ptr)
+{
+    size_t i = TraceSlot(ptr);
+
+    while (TraceTable[i].ptr && TraceTable[i].ptr != ptr)
+    {
+        i = (i + 1) % TRACE_SLOTS;
+    }
+
+    if (!TraceTable[i].ptr)
+    {
+        TraceStats.untracked++; // allocated while the table was full
+
+        return;
+    }
+
+    TraceStats.LiveBlocks--;
+
+    TraceStats.LiveBytes -= TraceTable[i].size;
+
+    for (size_t j = (i + 1) % TRACE_SLOTS; TraceTable[j].ptr; j = (j + 1) % TRACE_SLOTS)
+    {
+        size_t home = TraceSlot(TraceTable[j].ptr);
+
+        if ((j - home + TRACE_SLOTS) % TRACE_SLOTS >= (j - i + TRACE_SLOTS) % TRACE_SLOTS)
+        {
+            TraceTable[i] = TraceTable[j];
+
+            i = j;
+        }
+    }
+
+    TraceTable[i] = {};
+}
+
+size_t TraceSlot(const void* ptr)
+{
+    return (size_t) (((uint64_t) ptr >> 4) * 0x9E3779B97F4A7C15 >> 32) % TRACE_SLOTS;
+}
+
+// Writes the buffered events in the memory log format of the old per-call
+// fprintf, one batch per TRACE_BATCH events.
+
+void TraceFlush()
+{
+    for (size_t i = 0; TraceFile && i < TraceCount; i++)
+    {
+        const AllocEvent_t* event = &TraceEvents[i];
+
+        switch (event->kind)
+        {
+            case ALLOC_EVENT_CALLOC:
+                ON_HTML(fprintf(TraceFile, "<p>"
+                                           "Called calloc                                      <br>"
+                                           "Number of members: <em style=\"color:Red\">%ld</em><br>"
+                                           "Size   of members: <em style=\"color:Red\">%ld</em><br>"
+                                           "Returned: <em style=\"color:Red\">%p</em>          <br>"
+                                           "----------------------<br>"
+                                           "</p>",
+                                           event->nMemb,
+                                           event->size,
+                                           event->NewPtr));
+
+                ON_LOG( fprintf(TraceFile, "Called calloc         \n"
+                                           "Number of members: %ld\n"
+                                           "Size   of members: %ld\n"
+                                           "Returned: %p          \n"
+                                           "----------------------\n",
+                                           event->nMemb,
+                                           event->size,
+                                           event->NewPtr));
+                break;
+
+            case ALLOC_EVENT_MALLOC:
+                ON_HTML(fprintf(TraceFile, "<p>"
+                                           "Called malloc                                  <br>"
+                                           "Size in bytes: <em style=\"color:Red\">%ld</em><br>"
+                                           "Returned: <em style=\"color:Red\">%p</em>      <br>"
+                                           "----------------------<br>"
+                                           "</p>",
+                                           event->size,
+                                           event->NewPtr));
+
+                ON_LOG( fprintf(TraceFile, "Called malloc         \n"
+                                           "Size in bytes: %ld    \n"
+                                           "Returned: %p          \n"
+                                           "----------------------\n", event->size, event->NewPtr));
+                break;
+
+            case ALLOC_EVENT_REALLOC:
+                ON_HTML(fprintf(TraceFile, "<p>"
+                                           "Called realloc                                 <br>"
+                                           "Size in bytes: <em style=\"color:Red\">%ld</em><br>"
+                                           "Returned: <em style=\"color:Red\">%p</em>      <br>"
+                                           "----------------------<br>"
+                                           "</p>",
+                                           event->size,
+                                           event->NewPtr));
+
+                ON_LOG( fprintf(TraceFile, "Called realloc        \n"
+                                           "Size in bytes: %ld    \n"
+                                           "Returned: %p          \n"
+                                           "----------------------\n", event->size, event->NewPtr));
+                break;
+
+            case ALLOC_EVENT_FREE:
+                ON_HTML(fprintf(TraceFile, "<p>"
+                                           "Called free                             <br>"
+                                           "Pointer: <em style=\"color:Red\">%p</em><br>"
+                                           "----------------------<br>"
+                                           "</p>",
+                                           event->ptr));
+
+                ON_LOG( fprintf(TraceFile, "Called free           \n"
+                                           "Pointer: %p           \n"
+                                           "----------------------\n", event->ptr));
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    TraceCount = 0;
 }
+
@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stack.h"
+#include "dumper.h"
+
+// Asynchronous dump pipeline (ASYNC_DUMP builds).
+//
+// StackDump only fills a DumpRecord_t and puts it into a bounded lock-free ring
+// (Vyukov's MPMC queue with per-cell sequence numbers, used here with a single
+// consumer). A background thread formats records into the dump file with the
+// same layout as the synchronous path. When the ring is full the record is
+// dropped and counted instead of stalling the stack operation.
+//
+// The ring and its sequence numbers outlive a Stop/Start cycle. Stop lets the
+// worker drain every record already claimed, including those of pushes that
+// were still in flight (DumpPushers) when it was called.
+
+struct DumpCell_t
+{
+    uint64_t     seq;
+    DumpRecord_t record;
+};
+
+static DumpCell_t*    DumpRing      = nullptr;
+
+static FILE*          DumpAsyncFile = nullptr;
+
+static pthread_t      DumpThread;
+
+static bool           DumpRunning   = false;
+
+static uint64_t       DumpHead      = 0;
+
+alignas(CACHE_LINE_SIZE) static uint64_t DumpTail    = 0;
+
+alignas(CACHE_LINE_SIZE) static uint64_t DumpDropped = 0;
+
+alignas(CACHE_LINE_SIZE) static uint64_t DumpPushers = 0;
+
+static uint64_t       DumpReported  = 0; // drops already written, by the workers only
+
+static pthread_mutex_t TraceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t       TraceKeys[TRACE_STRINGS] = {};
+
+static uint32_t       TraceKeyOps[TRACE_STRINGS] = {};
+
+static void*          DumpWorker          (void* args);
+
+static bool           DumpDrain           ();
+
+static uint32_t       TraceString         (FILE* fp, const char* string);
+
+static uint32_t       TraceOpOf           (const char* function);
+
+uint64_t DumpNow()
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+StackReturnCode DumpEmit(FILE* fp, const DumpRecord_t* record, const StackElem_t* data)
+{
+    #ifdef BINARY_DUMP
+
+    return TraceWrite(fp, record, data);
+
+    #else
+
+    return DumpWrite(fp, record, data);
+
+    #endif
+}
+
+StackReturnCode DumpWrite(FILE* fp, const DumpRecord_t* record, const StackElem_t* data)
+{
+    if (!fp)
+    {
+        return FAILED;
+    }
+
+    time_t RawTime = (time_t) (record->timestamp / 1000000000);
+
+    struct tm TimeInfo = {};
+
+    char TimeString[32] = "";
+
+    localtime_r(&RawTime, &TimeInfo);
+
+    asctime_r(&TimeInfo, TimeString);
+
+    ON_HTML(fprintf(fp, "<p style=\"color:LightGrey;\">"
+                        "Local time and date: </p><p style=\"color:LightBlue;\">%s<bp>"
+                        "</p>", TimeString));
+
+    ON_LOG( fprintf(fp, "Local time and date: %s\n", TimeString));
+
+    PrintErr(fp, record->err);
+
+    if (record->LostStack)
+    {
+        ON_HTML(fprintf(fp, "<p style=\"color:Red\">"
+                            "Lost stack pointer</br>"
+                            "</p>"));
+
+        ON_LOG( fprintf(fp, "Lost stack pointer\n"));
+
+        return EXECUTED;
+    }
+
+    ON_LOG(fprintf(fp,  "Stack_t[%p] %s at %s:%d in function %s\nBorn at %s:%d in function %s\n\n"
+                        "Stack ID             = %ld\n\n"
+                        "LEFT  STRUCT CANARY  = %lu\n"
+                        "RIGHT STRUCT CANARY  = %lu\n\n"
+                        "LEFT  DATA   CANARY  = %lu\n"
+                        "RIGHT DATA   CANARY  = %lu\n\n"
+                        "STRUCT HASH          = %lu\n"
+                        "DATA   HASH          = %lu\n\n"
+                        "capacity             = %lu\n"
+                        "size                 = %lu\n\n",
+                        record->address, record->name, record->file, record->line, record->function,
+                        record->BornFile, record->BornLine, record->BornFunc,
+                        record->id,
+                        record->LeftCanary,
+                        record->RightCanary,
+                        record->DataLeftCanary,
+                        record->DataRightCanary,
+                        record->StructHash,
+                        record->DataHash,
+                        record->capacity,
+                        record->size));
+
+    ON_HTML(fprintf(fp, "<h3>Stack_t[<em style=\"color:Red;\">%p</em>] %s"
+                        " at <em style=\"color:Red;\">%s</em>:"
+                        "<em style=\"color:Red;\">%d</em> in function"
+                        " <em style=\"color:Red;\">%s</em><br>Born"
+                        " at <em style=\"color:Red;\">%s</em>:"
+                        "<em style=\"color:Red;\">%d</em> in function "
+                        "<em style=\"color:Red;\">%s</em></h1><br>"
+                        "Stack ID              = <em style=\"color:Red;\">%ld</em><br><br>"
+                        "LEFT   STRUCT CANARY  = <em style=\"color:Red;\">%lu</em><br>"
+                        "RIGHT  STRUCT CANARY  = <em style=\"color:Red;\">%lu</em><br><br>"
+                        "LEFT   DATA   CANARY  = <em style=\"color:Red;\">%lu</em><br>"
+                        "RIGHT  DATA   CANARY  = <em style=\"color:Red;\">%lu</em><br><br>"
+                        "STRUCT HASH           = <em style=\"color:Red;\">%lu</em><br>"
+                        "DATA   HASH           = <em style=\"color:Red;\">%lu</em><br><br>"
+                        "capacity              = <em style=\"color:Red;\">%lu</em><br>"
+                        "size                  = <em style=\"color:Red;\">%lu</em><br><br>"
+                        "</em>",
+                        record->address, record->name, record->file, record->line, record->function,
+                        record->BornFile, record->BornLine, record->BornFunc,
+                        record->id,
+                        record->LeftCanary,
+                        record->RightCanary,
+                        record->DataLeftCanary,
+                        record->DataRightCanary,
+                        record->StructHash,
+                        record->DataHash,
+                        record->capacity,
+                        record->size));
+
+    if (record->LostData)
+    {
+        ON_HTML(fprintf(fp, "<p style=\"color:LightRed\">"
+                            "Lost stack->data pointer<br>"
+                            "<br><br>---------------------------------------------------------------------<br><br></p>"));
+
+        ON_LOG(fprintf(fp,  "Lost stack->data pointer\n"
+                            "\n\n---------------------------------------------------------------------\n\n"));
+
+        return EXECUTED;
+    }
+
+    uint64_t first = data ? 0                : record->ElemsFirst;
+
+    uint64_t last  = data ? record->touched  : record->ElemsFirst + record->ElemsCount;
+
+    if (first > 0)
+    {
+        ON_HTML(fprintf(fp, "<em style=\"color:LightGrey;\">"
+                            "[0..%lu] not captured</em><br>", first - 1));
+
+        ON_LOG( fprintf(fp, "[0..%lu] not captured\n", first - 1));
+    }
+
+    for (uint64_t i = first; i < last; i++)
+    {
+        StackElem_t value = data ? data[i] : record->elems[i - first];
+
+        if (i < record->size)
+        {
+            ON_HTML(fprintf(fp, "<em style=\"color:LightGrey;\">"
+                                "[%lu] = </em><em style=\"color:LightBlue;\">%ld</em><br>", i, value));
+
+            ON_LOG( fprintf(fp, "[%lu] = %ld\n", i, value));
+        }
+        else
+        {
+            ON_HTML(fprintf(fp, "<em style=\"color:LightGrey;\">"
+                                "[%lu] = </em><em style=\"color:LightBlue;\">%ld (POISON)</em><br>", i, value));
+
+            ON_LOG( fprintf(fp, "[%lu] = %ld (POISON) \n", i, value));
+        }
+    }
+
+    if (data && last < record->capacity)
+    {
+        ON_HTML(fprintf(fp, "<em style=\"color:LightGrey;\">"
+                            "[%lu..%lu] not written yet</em><br>", last, record->capacity - 1));
+
+        ON_LOG( fprintf(fp, "[%lu..%lu] not written yet\n", last, record->capacity - 1));
+    }
+
+    ON_HTML(fprintf(fp, "<p><br><br>---------------------------------------------------------------------<br><br></p>"));
+
+    ON_LOG( fprintf(fp, "\n\n---------------------------------------------------------------------\n\n"));
+
+    return EXECUTED;
+}
+
+StackReturnCode DumpAsyncStart(FILE* fp)
+{
+    if (DumpRunning)
+    {
+        return EXECUTED;
+    }
+
+    if (!DumpRing)
+    {
+        DumpRing = (DumpCell_t*) calloc(DUMP_RING_SIZE, sizeof(DumpCell_t));
+
+        if (!DumpRing)
+        {
+            err |= INVALID_DATA_POINTER;
+
+            return FAILED;
+        }
+
+        for (uint64_t i = 0; i < DUMP_RING_SIZE; i++)
+        {
+            DumpRing[i].seq = i;
+        }
+    }
+
+    DumpAsyncFile = fp;
+
+    __atomic_store_n(&DumpRunning, true, __ATOMIC_RELEASE);
+
+    if (pthread_create(&DumpThread, NULL, DumpWorker, NULL) != 0)
+    {
+        DumpRunning = false;
+
+        return FAILED;
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode DumpAsyncPush(const DumpRecord_t* record)
+{
+    __atomic_add_fetch(&DumpPushers, 1, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&DumpRunning, __ATOMIC_SEQ_CST))
+    {
+        __atomic_sub_fetch(&DumpPushers, 1, __ATOMIC_RELEASE);
+
+        return FAILED;
+    }
+
+    uint64_t pos = __atomic_load_n(&DumpTail, __ATOMIC_RELAXED);
+
+    DumpCell_t* cell = nullptr;
+
+    while (true)
+    {
+        cell = &DumpRing[pos % DUMP_RING_SIZE];
+
+        int64_t diff = (int64_t) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t) pos;
+
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&DumpTail, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&DumpDropped, 1, __ATOMIC_RELAXED);
+
+            __atomic_sub_fetch(&DumpPushers, 1, __ATOMIC_RELEASE);
+
+            return FAILED;
+        }
+        else
+        {
+            pos = __atomic_load_n(&DumpTail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->record = *record;
+
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_sub_fetch(&DumpPushers, 1, __ATOMIC_RELEASE);
+
+    return EXECUTED;
+}
+
+StackReturnCode DumpAsyncStop()
+{
+    if (!__atomic_load_n(&DumpRunning, __ATOMIC_ACQUIRE))
+    {
+        return FAILED;
+    }
+
+    __atomic_store_n(&DumpRunning, false, __ATOMIC_SEQ_CST);
+
+    pthread_join(DumpThread, NULL); // returns once the ring is empty
+
+    DumpAsyncFile = nullptr;
+
+    return EXECUTED;
+}
+
+void* DumpWorker(void* args)
+{
+    uint64_t reported = DumpReported;
+
+    while (true)
+    {
+        bool wrote = DumpDrain();
+
+        uint64_t dropped = __atomic_load_n(&DumpDropped, __ATOMIC_RELAXED);
+
+        if (dropped != reported)
+        {
+            ON_HTML(fprintf(DumpAsyncFile, "<p style=\"color:Red\">%lu dump records dropped</p>", dropped - reported));
+
+            ON_LOG( fprintf(DumpAsyncFile, "%lu dump records dropped\n\n", dropped - reported));
+
+            reported = dropped;
+
+            DumpReported = dropped;
+        }
+
+        if (!wrote)
+        {
+            if (!__atomic_load_n(&DumpRunning, __ATOMIC_SEQ_CST) && __atomic_load_n(&DumpPushers, __ATOMIC_SEQ_CST) == 0 &&
+                __atomic_load_n(&DumpTail, __ATOMIC_ACQUIRE) == DumpHead)
+            {
+                break;
+            }
+
+            fflush(DumpAsyncFile);
+
+            struct timespec idle = {0, 1000000};
+
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    fflush(DumpAsyncFile);
+
+    return args;
+}
+
+bool DumpDrain()
+{
+    bool wrote = false;
+
+    while (true)
+    {
+        DumpCell_t* cell = &DumpRing[DumpHead % DUMP_RING_SIZE];
+
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != DumpHead + 1)
+        {
+            return wrote;
+        }
+
+        DumpEmit(DumpAsyncFile, &cell->record, nullptr);
+
+        __atomic_store_n(&cell->seq, DumpHead + DUMP_RING_SIZE, __ATOMIC_RELEASE);
+
+        DumpHead++;
+
+        wrote = true;
+    }
+}
+
+StackReturnCode TraceStart(FILE* fp)
+{
+    if (!fp)
+    {
+        return FAILED;
+    }
+
+    pthread_mutex_lock(&TraceMutex);
+
+    memset(TraceKeys, 0, sizeof(TraceKeys)); // reopened file: strings get written again
+
+    if (ftell(fp) == 0)
+    {
+        TraceHeader_t header = {};
+
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+
+        header.version    = TRACE_VERSION;
+
+        header.RecordSize = sizeof(TraceRecord_t);
+
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+
+    pthread_mutex_unlock(&TraceMutex);
+
+    return EXECUTED;
+}
+
+StackReturnCode TraceWrite(FILE* fp, const DumpRecord_t* record, const StackElem_t* data)
+{
+    if (!fp)
+    {
+        return FAILED;
+    }
+
+    pthread_mutex_lock(&TraceMutex);
+
+    TraceRecord_t trace = {};
+
+    trace.kind            = TRACE_DUMP;
+    trace.op              = TraceString(fp, record->function);
+    trace.timestamp       = record->timestamp;
+    trace.err             = record->err;
+    trace.address         = (uint64_t) record->address;
+    trace.id              = record->id;
+    trace.name            = (uint64_t) record->name;
+    trace.file            = (uint64_t) record->file;
+    trace.function        = (uint64_t) record->function;
+    trace.BornFile        = (uint64_t) record->BornFile;
+    trace.BornFunc        = (uint64_t) record->BornFunc;
+    trace.line            = record->line;
+    trace.BornLine        = record->BornLine;
+    trace.LeftCanary      = record->LeftCanary;
+    trace.RightCanary     = record->RightCanary;
+    trace.DataLeftCanary  = record->DataLeftCanary;
+    trace.DataRightCanary = record->DataRightCanary;
+    trace.StructHash      = record->StructHash;
+    trace.DataHash        = record->DataHash;
+    trace.capacity        = record->capacity;
+    trace.size            = record->size;
+    trace.flags           = (record->LostStack ? TRACE_LOST_STACK : 0) |
+                            (record->LostData  ? TRACE_LOST_DATA  : 0);
+
+    TraceString(fp, record->name);
+    TraceString(fp, record->file);
+    TraceString(fp, record->BornFile);
+    TraceString(fp, record->BornFunc);
+
+    #ifdef TRACE_ELEMS
+
+    const StackElem_t* elems = nullptr;
+
+    if (data) // like DumpWrite: slots past touched were never written
+    {
+        uint64_t count   = record->touched < record->capacity ? record->touched : record->capacity;
+
+        trace.ElemsFirst = count > TRACE_MAX_ELEMS ? count - TRACE_MAX_ELEMS : 0; // keep the top
+
+        elems            = data + trace.ElemsFirst;
+
+        trace.payload    = (uint32_t) ((count - trace.ElemsFirst) * sizeof(StackElem_t));
+
+        trace.flags     |= trace.ElemsFirst == 0 ? TRACE_WRITTEN_ELEMS : 0;
+    }
+    else
+    {
+        elems            = record->elems;
+
+        trace.ElemsFirst = record->ElemsFirst;
+
+        trace.payload    = (uint32_t) (record->ElemsCount * sizeof(StackElem_t));
+    }
+
+    #else
+
+    trace.ElemsFirst = record->size; // nothing captured
+
+    (void) data;
+
+    #endif
+
+    fwrite(&trace, sizeof(trace), 1, fp);
+
+    #ifdef TRACE_ELEMS
+
+    fwrite(elems, 1, trace.payload, fp);
+
+    #endif
+
+    pthread_mutex_unlock(&TraceMutex);
+
+    return EXECUTED;
+}
+
+// Writes a TRACE_STRING record the first time an address is seen and returns
+// the TraceOp of the string, so the op of a dump is derived once per call site.
+
+uint32_t TraceString(FILE* fp, const char* string)
+{
+    if (!string)
+    {
+        return TRACE_OP_OTHER;
+    }
+
+    uint64_t key  = (uint64_t) string;
+
+    uint64_t slot = (key >> 3) % TRACE_STRINGS;
+
+    for (int probe = 0; probe < TRACE_STRINGS; probe++)
+    {
+        uint64_t i = (slot + (uint64_t) probe) % TRACE_STRINGS;
+
+        if (TraceKeys[i] == key)
+        {
+            return TraceKeyOps[i];
+        }
+
+        if (TraceKeys[i] == 0)
+        {
+            TraceKeys[i]   = key;
+
+            TraceKeyOps[i] = TraceOpOf(string);
+
+            break;
+        }
+    }
+
+    // Table full: the string is written again, readers keep the last definition.
+
+    TraceRecord_t trace = {};
+
+    trace.kind    = TRACE_STRING;
+
+    trace.address = key;
+
+    trace.payload = (uint32_t) strlen(string);
+
+    fwrite(&trace, sizeof(trace), 1, fp);
+
+    fwrite(string, 1, trace.payload, fp);
+
+    return TraceOpOf(string);
+}
+
+uint32_t TraceOpOf(const char* function)
+{
+    if (strstr(function, "StackDtor"))   return TRACE_OP_DTOR;
+
+    if (strstr(function, "StackCtor"))   return TRACE_OP_CTOR;
+
+    if (strstr(function, "StackPush"))   return TRACE_OP_PUSH;
+
+    if (strstr(function, "StackPop"))    return TRACE_OP_POP;
+
+    if (strstr(function, "StackResize")) return TRACE_OP_RESIZE;
+
+    if (strstr(function, "StackVerify")) return TRACE_OP_VERIFY;
+
+    return TRACE_OP_OTHER;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stack.h"
+#include "elimination.h"
+#include "allocation.h"
+
+// Elimination array: a push and a pop that meet in the same slot cancel out
+// without touching the stack. Pushers offer a value and wait a bounded time,
+// poppers take an offered value. Every claim of a slot bumps its sequence
+// number, so a popper can never take a value from an offer that was
+// withdrawn and replaced between its load and its CAS.
+
+#define SLOT_STATE(seq, kind)  (((seq) << 2) | (kind))
+
+#define SLOT_SEQ(  state)      ((state) >> 2)
+
+#define SLOT_KIND( state)      ((state) & 3)
+
+const int      ELIMINATION_SLOTS = 16;
+
+const int      ELIMINATION_SPINS = 128;
+
+typedef enum SlotKinds
+{
+    SLOT_EMPTY   = 0,
+    SLOT_BUSY    = 1,
+    SLOT_OFFERED = 2,
+    SLOT_TAKEN   = 3,
+} SlotKind;
+
+struct EliminationSlot_t
+{
+    alignas(CACHE_LINE_SIZE) uint64_t    state;
+                             StackElem_t value;
+};
+
+struct EliminationArray_t
+{
+    EliminationSlot_t slots[ELIMINATION_SLOTS];
+    FILE*             MemoryLogFile;
+};
+
+static __thread uint32_t     RandomState = 0;
+
+static __thread int          SlotRange   = ELIMINATION_SLOTS;
+
+static EliminationSlot_t*    PickSlot            (EliminationArray_t* elimination);
+
+static inline void           CpuRelax            ();
+
+EliminationArray_t* EliminationCtor(FILE* MemoryLogFile)
+{
+    EliminationArray_t* elimination = (EliminationArray_t*) log_aligned_calloc(MemoryLogFile, CACHE_LINE_SIZE, sizeof(EliminationArray_t));
+
+    if (!elimination)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return nullptr;
+    }
+
+    elimination->MemoryLogFile = MemoryLogFile;
+
+    return elimination;
+}
+
+StackReturnCode EliminationPush(EliminationArray_t* elimination, StackElem_t value)
+{
+    EliminationSlot_t* slot = PickSlot(elimination);
+
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+    if (SLOT_KIND(state) != SLOT_EMPTY)
+    {
+        return FAILED;
+    }
+
+    uint64_t seq = SLOT_SEQ(state) + 1;
+
+    if (!__atomic_compare_exchange_n(&slot->state, &state, SLOT_STATE(seq, SLOT_BUSY),
+                                     false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return FAILED;
+    }
+
+    __atomic_store_n(&slot->value, value, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->state, SLOT_STATE(seq, SLOT_OFFERED), __ATOMIC_RELEASE);
+
+    for (int i = 0; i < ELIMINATION_SPINS; i++)
+    {
+        if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == SLOT_STATE(seq, SLOT_TAKEN))
+        {
+            __atomic_store_n(&slot->state, SLOT_STATE(seq, SLOT_EMPTY), __ATOMIC_RELEASE);
+
+            SlotRange = SlotRange < ELIMINATION_SLOTS ? SlotRange * 2 : ELIMINATION_SLOTS;
+
+            return EXECUTED;
+        }
+
+        CpuRelax();
+    }
+
+    state = SLOT_STATE(seq, SLOT_OFFERED);
+
+    if (__atomic_compare_exchange_n(&slot->state, &state, SLOT_STATE(seq, SLOT_EMPTY),
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        SlotRange = SlotRange > 1 ? SlotRange / 2 : 1; // nobody came, concentrate on fewer slots
+
+        return FAILED;
+    }
+
+    __atomic_store_n(&slot->state, SLOT_STATE(seq, SLOT_EMPTY), __ATOMIC_RELEASE);
+
+    return EXECUTED;
+}
+
+StackReturnCode EliminationPop(EliminationArray_t* elimination, StackElem_t* value)
+{
+    EliminationSlot_t* slot = PickSlot(elimination);
+
+    for (int i = 0; i < ELIMINATION_SPINS; i++)
+    {
+        uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+        if (SLOT_KIND(state) == SLOT_OFFERED)
+        {
+            StackElem_t offered = __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+
+            if (__atomic_compare_exchange_n(&slot->state, &state, SLOT_STATE(SLOT_SEQ(state), SLOT_TAKEN),
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            {
+                *value = offered;
+
+                return EXECUTED;
+            }
+        }
+
+        CpuRelax();
+    }
+
+    return FAILED;
+}
+
+StackReturnCode EliminationDtor(EliminationArray_t* elimination)
+{
+    if (!elimination)
+    {
+        return FAILED;
+    }
+
+    log_aligned_free(elimination->MemoryLogFile, elimination);
+
+    return EXECUTED;
+}
+
+EliminationSlot_t* PickSlot(EliminationArray_t* elimination)
+{
+    if (RandomState == 0)
+    {
+        RandomState = (uint32_t) (uintptr_t) &RandomState | 1;
+    }
+
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+
+    return &elimination->slots[RandomState % (uint32_t) SlotRange];
+}
+
+void CpuRelax()
+{
+    #if defined(__x86_64__) || defined(__i386__)
+
+    __builtin_ia32_pause();
+
+    #endif
+}
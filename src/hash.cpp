@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "hash.h"
+
+// Block hashing backends, picked once per process from what the CPU supports.
+//
+// Both kernels have a scalar twin that returns exactly the same value, so a hash
+// stored by one machine (StackOpen files) or by the O(1) push/pop updates checks
+// out against a full recount on any other:
+//
+//     DataBlockHash    sum of DataElemHash, 4 elements per AVX2 step
+//     StructBlockHash  CRC32C, 8 bytes per SSE4.2 crc32 or 1 byte per table lookup
+
+const uint32_t CRC32C_POLY = 0x82F63B78; // reflected Castagnoli
+
+static pthread_once_t HashOnce = PTHREAD_ONCE_INIT;
+
+static uint32_t       Crc32cTable[256] = {};
+
+static uint64_t     (*DataBlockKernel)  (const StackElem_t* data, uint64_t size, uint64_t first) = nullptr;
+
+static uint32_t     (*StructBlockKernel)(uint32_t crc, const unsigned char* block, size_t size) = nullptr;
+
+static const char*    Backend = "scalar";
+
+static void           HashInit          ();
+
+static uint64_t       DataBlockScalar   (const StackElem_t* data, uint64_t size, uint64_t first);
+
+static uint32_t       StructBlockScalar (uint32_t crc, const unsigned char* block, size_t size);
+
+#if defined(__x86_64__)
+
+static uint64_t       DataBlockAvx2     (const StackElem_t* data, uint64_t size, uint64_t first);
+
+static uint32_t       StructBlockSse42  (uint32_t crc, const unsigned char* block, size_t size);
+
+#endif
+
+uint64_t DataBlockHash(const StackElem_t* data, uint64_t size, uint64_t first)
+{
+    pthread_once(&HashOnce, HashInit);
+
+    return DataBlockKernel(data, size, first);
+}
+
+uint64_t StructBlockHash(uint64_t hash, const void* block, size_t size)
+{
+    pthread_once(&HashOnce, HashInit);
+
+    return StructBlockKernel((uint32_t) hash, (const unsigned char*) block, size);
+}
+
+const char* HashBackend()
+{
+    pthread_once(&HashOnce, HashInit);
+
+    return Backend;
+}
+
+// Runs every kernel this CPU supports, not just the one picked, on the same
+// input and compares it with its scalar twin.
+
+StackReturnCode HashCheckKernels(const StackElem_t* data, uint64_t size, uint64_t first,
+                                 const void* block, size_t BlockSize)
+{
+    pthread_once(&HashOnce, HashInit);
+
+    const unsigned char* bytes = (const unsigned char*) block;
+
+    uint64_t DataHash   = DataBlockScalar(data, size, first);
+
+    uint32_t StructHash = StructBlockScalar(5831, bytes, BlockSize);
+
+    bool agree = DataBlockKernel(data, size, first) == DataHash && StructBlockKernel(5831, bytes, BlockSize) == StructHash;
+
+    #if defined(__x86_64__)
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        agree = agree && DataBlockAvx2(data, size, first) == DataHash;
+    }
+
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        agree = agree && StructBlockSse42(5831, bytes, BlockSize) == StructHash;
+    }
+
+    #endif
+
+    return agree ? EXECUTED : FAILED;
+}
+
+void HashInit()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        }
+
+        Crc32cTable[i] = crc;
+    }
+
+    DataBlockKernel   = DataBlockScalar;
+
+    StructBlockKernel = StructBlockScalar;
+
+    #if defined(__x86_64__)
+
+    __builtin_cpu_init();
+
+    bool avx2  = __builtin_cpu_supports("avx2");
+
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+
+    if (avx2)
+    {
+        DataBlockKernel   = DataBlockAvx2;
+    }
+
+    if (sse42)
+    {
+        StructBlockKernel = StructBlockSse42;
+    }
+
+    Backend = avx2 && sse42 ? "avx2+sse4.2" : avx2 ? "avx2" : sse42 ? "sse4.2" : "scalar";
+
+    #endif
+}
+
+uint64_t DataBlockScalar(const StackElem_t* data, uint64_t size, uint64_t first)
+{
+    uint64_t hash = 0;
+
+    for (uint64_t i = 0; i < size; i++)
+    {
+        hash += DataElemHash(data[i], first + i);
+    }
+
+    return hash;
+}
+
+uint32_t StructBlockScalar(uint32_t crc, const unsigned char* block, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = Crc32cTable[(crc ^ block[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+// DataElemHash on 4 lanes. AVX2 has no 64-bit multiply, so the two multiplies by
+// constants are built from 32 x 32 -> 64 bit products: lo * lo + ((hi * lo + lo * hi) << 32).
+
+__attribute__((target("avx2"))) static inline __m256i Mul64(__m256i x, uint64_t constant)
+{
+    __m256i c     = _mm256_set1_epi64x((long long) constant);
+
+    __m256i low   = _mm256_mul_epu32(x, c);
+
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), c),
+                                     _mm256_mul_epu32(x, _mm256_srli_epi64(c, 32)));
+
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2"))) uint64_t DataBlockAvx2(const StackElem_t* data, uint64_t size, uint64_t first)
+{
+    const uint64_t GOLDEN = 0x9E3779B97F4A7C15;
+
+    __m256i sum  = _mm256_setzero_si256();
+
+    __m256i pos  = _mm256_set_epi64x((long long) ((first + 4) * GOLDEN), (long long) ((first + 3) * GOLDEN),
+                                     (long long) ((first + 2) * GOLDEN), (long long) ((first + 1) * GOLDEN));
+
+    __m256i step = _mm256_set1_epi64x((long long) (4 * GOLDEN));
+
+    uint64_t i = 0;
+
+    for (; i + 4 <= size; i += 4)
+    {
+        __m256i x = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) (data + i)), pos);
+
+        x = Mul64(_mm256_xor_si256(x, _mm256_srli_epi64(x, 30)), 0xBF58476D1CE4E5B9);
+
+        x = Mul64(_mm256_xor_si256(x, _mm256_srli_epi64(x, 27)), 0x94D049BB133111EB);
+
+        sum = _mm256_add_epi64(sum, _mm256_xor_si256(x, _mm256_srli_epi64(x, 31)));
+
+        pos = _mm256_add_epi64(pos, step);
+    }
+
+    uint64_t lanes[4] = {};
+
+    _mm256_storeu_si256((__m256i*) lanes, sum);
+
+    uint64_t hash = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    for (; i < size; i++)
+    {
+        hash += DataElemHash(data[i], first + i);
+    }
+
+    return hash;
+}
+
+__attribute__((target("sse4.2"))) uint32_t StructBlockSse42(uint32_t crc, const unsigned char* block, size_t size)
+{
+    uint64_t wide = crc;
+
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+
+        memcpy(&word, block + i, sizeof(uint64_t));
+
+        wide = _mm_crc32_u64(wide, word);
+    }
+
+    crc = (uint32_t) wide;
+
+    for (; i < size; i++)
+    {
+        crc = _mm_crc32_u8(crc, block[i]);
+    }
+
+    return crc;
+}
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stack.h"
+#include "lockfree.h"
+#include "elimination.h"
+#include "allocation.h"
+
+// Treiber stack over an index-addressed node pool.
+//
+// Heads are tagged 64-bit words: (tag << 32) | (index + 1), index 0 meaning "empty".
+// The tag is bumped on every successful CAS, so a head that was popped and pushed
+// back between a load and a CAS (ABA) is rejected. Nodes are never returned to the
+// allocator while the stack is alive - popped nodes go to a tagged free list and are
+// reused - so a thread holding a stale index always reads valid memory.
+
+#define TAGGED(     tag, index) (((uint64_t) (tag) << 32) | (uint32_t) (index))
+
+#define TAG_OF(     head)       ((uint32_t) ((head) >> 32))
+
+#define INDEX_OF(   head)       ((uint32_t) (head))
+
+const int LOCK_FREE_SEGMENTS = 32;
+
+struct LockFreeNode_t
+{
+    StackElem_t     value;
+    uint32_t        next;
+};
+
+struct LockFreeStack_t
+{
+    alignas(CACHE_LINE_SIZE) uint64_t top;
+    alignas(CACHE_LINE_SIZE) uint64_t FreeList;
+    alignas(CACHE_LINE_SIZE) uint64_t allocated;
+
+                             uint64_t            SegmentBase;
+                             EliminationArray_t* elimination;
+                             FILE*               MemoryLogFile;
+                             LockFreeNode_t*     segments[LOCK_FREE_SEGMENTS];
+};
+
+static LockFreeNode_t*   GetNode             (LockFreeStack_t* LockFree, uint32_t index);
+
+static uint32_t          AllocNode           (LockFreeStack_t* LockFree);
+
+static void              FreeNode            (LockFreeStack_t* LockFree, uint32_t index);
+
+static LockFreeNode_t*   GetSegment          (LockFreeStack_t* LockFree, int segment);
+
+LockFreeStack_t* LockFreeCtor(uint64_t capacity, EliminationArray_t* elimination, FILE* MemoryLogFile)
+{
+    LockFreeStack_t* LockFree = (LockFreeStack_t*) log_aligned_calloc(MemoryLogFile, CACHE_LINE_SIZE, sizeof(LockFreeStack_t));
+
+    if (!LockFree)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return nullptr;
+    }
+
+    LockFree->SegmentBase   = capacity < MIN_STACK_SIZE ? MIN_STACK_SIZE : capacity;
+
+    LockFree->elimination   = elimination;
+
+    LockFree->MemoryLogFile = MemoryLogFile;
+
+    if (!GetSegment(LockFree, 0))
+    {
+        log_aligned_free(MemoryLogFile, LockFree);
+
+        return nullptr;
+    }
+
+    return LockFree;
+}
+
+StackReturnCode LockFreePush(LockFreeStack_t* LockFree, StackElem_t value)
+{
+    uint32_t index = AllocNode(LockFree);
+
+    if (index == 0)
+    {
+        err |= STACK_OVERFLOW;
+
+        return FAILED;
+    }
+
+    LockFreeNode_t* node = GetNode(LockFree, index);
+
+    node->value = value;
+
+    uint64_t top = __atomic_load_n(&LockFree->top, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&node->next, INDEX_OF(top), __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&LockFree->top, &top, TAGGED(TAG_OF(top) + 1, index),
+                                        false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        if (LockFree->elimination && EliminationPush(LockFree->elimination, value) == EXECUTED)
+        {
+            FreeNode(LockFree, index);
+
+            return EXECUTED;
+        }
+
+        __atomic_store_n(&node->next, INDEX_OF(top), __ATOMIC_RELAXED);
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode LockFreePop(LockFreeStack_t* LockFree, StackElem_t* value)
+{
+    uint64_t top = __atomic_load_n(&LockFree->top, __ATOMIC_ACQUIRE);
+
+    LockFreeNode_t* node = nullptr;
+
+    while (true)
+    {
+        if (INDEX_OF(top) == 0)
+        {
+            err |= STACK_UNDERFLOW;
+
+            return FAILED;
+        }
+
+        node = GetNode(LockFree, INDEX_OF(top));
+
+        if (__atomic_compare_exchange_n(&LockFree->top, &top,
+                                        TAGGED(TAG_OF(top) + 1, __atomic_load_n(&node->next, __ATOMIC_RELAXED)),
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        if (LockFree->elimination && EliminationPop(LockFree->elimination, value) == EXECUTED)
+        {
+            return EXECUTED;
+        }
+
+        top = __atomic_load_n(&LockFree->top, __ATOMIC_ACQUIRE);
+    }
+
+    *value = node->value;
+
+    FreeNode(LockFree, INDEX_OF(top));
+
+    return EXECUTED;
+}
+
+StackReturnCode LockFreeDtor(LockFreeStack_t* LockFree)
+{
+    if (!LockFree)
+    {
+        return FAILED;
+    }
+
+    for (int i = 0; i < LOCK_FREE_SEGMENTS; i++)
+    {
+        if (LockFree->segments[i])
+        {
+            log_free(LockFree->MemoryLogFile, LockFree->segments[i]);
+        }
+    }
+
+    log_aligned_free(LockFree->MemoryLogFile, LockFree);
+
+    return EXECUTED;
+}
+
+// Segment s holds SegmentBase << s nodes, so the pool doubles like the locked stack
+// but never moves a node that another thread may still be reading.
+
+LockFreeNode_t* GetNode(LockFreeStack_t* LockFree, uint32_t index)
+{
+    uint64_t i = index - 1;
+
+    int segment = 63 - __builtin_clzll(i / LockFree->SegmentBase + 1);
+
+    uint64_t offset = i - LockFree->SegmentBase * ((1ull << segment) - 1);
+
+    return __atomic_load_n(&LockFree->segments[segment], __ATOMIC_ACQUIRE) + offset;
+}
+
+LockFreeNode_t* GetSegment(LockFreeStack_t* LockFree, int segment)
+{
+    LockFreeNode_t* nodes = __atomic_load_n(&LockFree->segments[segment], __ATOMIC_ACQUIRE);
+
+    if (nodes)
+    {
+        return nodes;
+    }
+
+    LockFreeNode_t* NewNodes = (LockFreeNode_t*) log_calloc(LockFree->MemoryLogFile,
+                                                            LockFree->SegmentBase << segment,
+                                                            sizeof(LockFreeNode_t));
+
+    if (!NewNodes)
+    {
+        err |= INVALID_DATA_POINTER;
+
+        return nullptr;
+    }
+
+    if (!__atomic_compare_exchange_n(&LockFree->segments[segment], &nodes, NewNodes,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        log_free(LockFree->MemoryLogFile, NewNodes);
+
+        return nodes;
+    }
+
+    return NewNodes;
+}
+
+uint32_t AllocNode(LockFreeStack_t* LockFree)
+{
+    uint64_t head = __atomic_load_n(&LockFree->FreeList, __ATOMIC_ACQUIRE);
+
+    while (INDEX_OF(head) != 0)
+    {
+        LockFreeNode_t* node = GetNode(LockFree, INDEX_OF(head));
+
+        uint64_t next = TAGGED(TAG_OF(head) + 1, __atomic_load_n(&node->next, __ATOMIC_RELAXED));
+
+        if (__atomic_compare_exchange_n(&LockFree->FreeList, &head, next,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return INDEX_OF(head);
+        }
+    }
+
+    uint64_t i = __atomic_fetch_add(&LockFree->allocated, 1, __ATOMIC_RELAXED);
+
+    if (i >= MAX_STACK_SIZE)
+    {
+        return 0;
+    }
+
+    if (!GetSegment(LockFree, 63 - __builtin_clzll(i / LockFree->SegmentBase + 1)))
+    {
+        return 0;
+    }
+
+    return (uint32_t) (i + 1);
+}
+
+void FreeNode(LockFreeStack_t* LockFree, uint32_t index)
+{
+    LockFreeNode_t* node = GetNode(LockFree, index);
+
+    uint64_t head = __atomic_load_n(&LockFree->FreeList, __ATOMIC_RELAXED);
+
+    do
+    {
+        __atomic_store_n(&node->next, INDEX_OF(head), __ATOMIC_RELAXED);
+    }
+    while (!__atomic_compare_exchange_n(&LockFree->FreeList, &head, TAGGED(TAG_OF(head) + 1, index),
+                                        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "stack.h"
+#include "registry.h"
+
+// Stack ids are (generation << 32) | (slot index + 1). Slots live in fixed-size
+// chunks that are allocated on demand and never moved or freed, free slots are
+// kept on a tagged lock-free list, so StackCtor/StackDtor are O(1) and a lookup
+// is two loads. Releasing a slot bumps its generation, which turns every id
+// handed out for it before into a cheap lookup miss.
+
+#define TAGGED(     tag, index) (((uint64_t) (tag) << 32) | (uint32_t) (index))
+
+#define TAG_OF(     head)       ((uint32_t) ((head) >> 32))
+
+#define INDEX_OF(   head)       ((uint32_t) (head))
+
+const    int       REGISTRY_CHUNK_SIZE = 1024;
+
+const    int       REGISTRY_CHUNKS     = MAX_STACK_AMOUNT / REGISTRY_CHUNK_SIZE;
+
+const    uint32_t  GENERATION_MASK     = 0x7FFFFFFF;
+
+static   StackSlot_t* REGISTRY[REGISTRY_CHUNKS] = {nullptr};
+
+static   uint64_t     FreeSlots = 0;
+
+static   uint64_t     SlotsUsed = 0;
+
+static StackSlot_t*      GetChunk            (int chunk);
+
+static StackSlot_t*      SlotAt              (uint32_t index);
+
+StackId_t RegistryAcquire()
+{
+    uint64_t head = __atomic_load_n(&FreeSlots, __ATOMIC_ACQUIRE);
+
+    while (INDEX_OF(head) != 0)
+    {
+        StackSlot_t* slot = SlotAt(INDEX_OF(head) - 1);
+
+        uint64_t next = TAGGED(TAG_OF(head) + 1, __atomic_load_n(&slot->NextFree, __ATOMIC_RELAXED));
+
+        if (__atomic_compare_exchange_n(&FreeSlots, &head, next,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return ((StackId_t) __atomic_load_n(&slot->generation, __ATOMIC_RELAXED) << 32) | INDEX_OF(head);
+        }
+    }
+
+    uint64_t index = __atomic_fetch_add(&SlotsUsed, 1, __ATOMIC_RELAXED);
+
+    if (index >= MAX_STACK_AMOUNT)
+    {
+        return INVALID_STACK_ID;
+    }
+
+    if (!GetChunk((int) (index / REGISTRY_CHUNK_SIZE)))
+    {
+        return INVALID_STACK_ID;
+    }
+
+    return (StackId_t) (index + 1);
+}
+
+StackSlot_t* RegistryGet(StackId_t StackId)
+{
+    uint64_t index = (uint64_t) (StackId & 0xFFFFFFFF) - 1;
+
+    if (StackId <= 0 || index >= MAX_STACK_AMOUNT)
+    {
+        return nullptr;
+    }
+
+    StackSlot_t* chunk = __atomic_load_n(&REGISTRY[index / REGISTRY_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+
+    if (!chunk)
+    {
+        return nullptr;
+    }
+
+    StackSlot_t* slot = chunk + index % REGISTRY_CHUNK_SIZE;
+
+    if (__atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) != (uint32_t) (StackId >> 32))
+    {
+        return nullptr;
+    }
+
+    return slot;
+}
+
+StackReturnCode RegistryRelease(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        return FAILED;
+    }
+
+    __atomic_store_n(&slot->stack, (Stack_t*) nullptr, __ATOMIC_RELEASE);
+
+    slot->elimination = nullptr;
+
+    __atomic_store_n(&slot->generation, (slot->generation + 1) & GENERATION_MASK, __ATOMIC_RELEASE);
+
+    uint64_t head = __atomic_load_n(&FreeSlots, __ATOMIC_RELAXED);
+
+    do
+    {
+        __atomic_store_n(&slot->NextFree, INDEX_OF(head), __ATOMIC_RELAXED);
+    }
+    while (!__atomic_compare_exchange_n(&FreeSlots, &head, TAGGED(TAG_OF(head) + 1, StackId & 0xFFFFFFFF),
+                                        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return EXECUTED;
+}
+
+// Id of the first live stack after StackId in slot order, or INVALID_STACK_ID
+// past the last one. Start the walk from INVALID_STACK_ID.
+
+StackId_t RegistryNext(StackId_t StackId)
+{
+    uint64_t used = __atomic_load_n(&SlotsUsed, __ATOMIC_ACQUIRE);
+
+    if (used > MAX_STACK_AMOUNT)
+    {
+        used = MAX_STACK_AMOUNT;
+    }
+
+    for (uint64_t index = StackId > 0 ? (uint64_t) (StackId & 0xFFFFFFFF) : 0; index < used; index++)
+    {
+        StackSlot_t* chunk = __atomic_load_n(&REGISTRY[index / REGISTRY_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+
+        if (!chunk)
+        {
+            index += REGISTRY_CHUNK_SIZE - 1 - index % REGISTRY_CHUNK_SIZE;
+
+            continue;
+        }
+
+        StackSlot_t* slot = chunk + index % REGISTRY_CHUNK_SIZE;
+
+        uint32_t generation = __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&slot->stack, __ATOMIC_ACQUIRE))
+        {
+            return ((StackId_t) generation << 32) | (StackId_t) (index + 1);
+        }
+    }
+
+    return INVALID_STACK_ID;
+}
+
+// Walks every live slot without locking and returns the first one match accepts.
+// It only loads and never allocates, so the SIGSEGV handler may call it.
+
+StackSlot_t* RegistryFind(bool (*match)(const StackSlot_t* slot, const void* args), const void* args)
+{
+    uint64_t used = __atomic_load_n(&SlotsUsed, __ATOMIC_ACQUIRE);
+
+    if (used > MAX_STACK_AMOUNT)
+    {
+        used = MAX_STACK_AMOUNT;
+    }
+
+    for (uint64_t index = 0; index < used; index++)
+    {
+        StackSlot_t* chunk = __atomic_load_n(&REGISTRY[index / REGISTRY_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+
+        if (!chunk)
+        {
+            index += REGISTRY_CHUNK_SIZE - 1 - index % REGISTRY_CHUNK_SIZE;
+
+            continue;
+        }
+
+        StackSlot_t* slot = chunk + index % REGISTRY_CHUNK_SIZE;
+
+        if (__atomic_load_n(&slot->stack, __ATOMIC_ACQUIRE) && match(slot, args))
+        {
+            return slot;
+        }
+    }
+
+    return nullptr;
+}
+
+StackSlot_t* GetChunk(int chunk)
+{
+    StackSlot_t* slots = __atomic_load_n(&REGISTRY[chunk], __ATOMIC_ACQUIRE);
+
+    if (slots)
+    {
+        return slots;
+    }
+
+    StackSlot_t* NewSlots = (StackSlot_t*) calloc(REGISTRY_CHUNK_SIZE, sizeof(StackSlot_t));
+
+    if (!NewSlots)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return nullptr;
+    }
+
+    for (int i = 0; i < REGISTRY_CHUNK_SIZE; i++)
+    {
+        pthread_mutex_init(&NewSlots[i].mutex, NULL);
+    }
+
+    if (!__atomic_compare_exchange_n(&REGISTRY[chunk], &slots, NewSlots,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        free(NewSlots);
+
+        return slots;
+    }
+
+    return NewSlots;
+}
+
+StackSlot_t* SlotAt(uint32_t index)
+{
+    return __atomic_load_n(&REGISTRY[index / REGISTRY_CHUNK_SIZE], __ATOMIC_ACQUIRE) + index % REGISTRY_CHUNK_SIZE;
+}
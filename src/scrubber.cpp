@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "stack.h"
+#include "registry.h"
+
+// Background scrubber.
+//
+// A thread walks the registry every PeriodMs and runs StackScrub on each stack,
+// so damage is found within about one period even when the stacks run with
+// STACK_CHECK_SAMPLED/EVERY_N or no inline checks at all. StackScrub reads a
+// stack under its slot lock, which only excludes the stack operations in
+// THREAD_PROTECTION (or DEBUG) builds, so the thread refuses to start otherwise;
+// StackScrubAll can still be called from the thread that owns the stacks.
+
+static pthread_t       ScrubThread;
+
+static pthread_mutex_t ScrubMutex   = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_cond_t  ScrubCond    = PTHREAD_COND_INITIALIZER;
+
+static bool            ScrubRunning = false;
+
+static uint64_t        ScrubPeriod  = 0;
+
+static void*           ScrubWorker         (void* args);
+
+StackReturnCode StackScrubAll()
+{
+    StackReturnCode code = STACK_NOT_DAMAGED;
+
+    for (StackId_t id = RegistryNext(INVALID_STACK_ID); id != INVALID_STACK_ID; id = RegistryNext(id))
+    {
+        if (StackScrub(id) == STACK_DAMAGED)
+        {
+            code = STACK_DAMAGED;
+        }
+    }
+
+    return code;
+}
+
+StackReturnCode StackScrubStart(uint64_t PeriodMs)
+{
+    #ifndef THREAD_PROTECTION
+
+    (void) PeriodMs;
+
+    return FAILED;
+
+    #else
+
+    pthread_mutex_lock(&ScrubMutex);
+
+    if (ScrubRunning)
+    {
+        pthread_mutex_unlock(&ScrubMutex);
+
+        return EXECUTED;
+    }
+
+    ScrubPeriod  = PeriodMs > 0 ? PeriodMs : 1;
+
+    ScrubRunning = true;
+
+    if (pthread_create(&ScrubThread, NULL, ScrubWorker, NULL) != 0)
+    {
+        ScrubRunning = false;
+
+        pthread_mutex_unlock(&ScrubMutex);
+
+        return FAILED;
+    }
+
+    pthread_mutex_unlock(&ScrubMutex);
+
+    return EXECUTED;
+
+    #endif
+}
+
+StackReturnCode StackScrubStop()
+{
+    pthread_mutex_lock(&ScrubMutex);
+
+    if (!ScrubRunning)
+    {
+        pthread_mutex_unlock(&ScrubMutex);
+
+        return FAILED;
+    }
+
+    ScrubRunning = false;
+
+    pthread_cond_signal(&ScrubCond);
+
+    pthread_mutex_unlock(&ScrubMutex);
+
+    pthread_join(ScrubThread, NULL);
+
+    return EXECUTED;
+}
+
+void* ScrubWorker(void* args)
+{
+    (void) args;
+
+    pthread_mutex_lock(&ScrubMutex);
+
+    while (ScrubRunning)
+    {
+        pthread_mutex_unlock(&ScrubMutex);
+
+        StackScrubAll();
+
+        struct timespec deadline = {};
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_sec  += (time_t) (ScrubPeriod / 1000);
+
+        deadline.tv_nsec += (long) (ScrubPeriod % 1000) * 1000000;
+
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec  += 1;
+
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&ScrubMutex);
+
+        while (ScrubRunning && pthread_cond_timedwait(&ScrubCond, &ScrubMutex, &deadline) != ETIMEDOUT)
+        {
+        }
+    }
+
+    pthread_mutex_unlock(&ScrubMutex);
+
+    return nullptr;
+}
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stack.h"
+#include "segmented.h"
+#include "allocation.h"
+#include "hash.h"
+
+// Segmented storage (STACK_STORAGE_SEGMENTED).
+//
+// Elements live in a chain of fixed-size chunks linked from the top down. A push
+// that fills the top chunk links a new one, a pop that empties it unlinks it, so
+// nothing is ever copied and an element keeps its address while it is on the
+// stack. The last unlinked chunk is kept as a spare, which stops a stack that
+// oscillates around a chunk boundary from allocating on every operation.
+//
+// Every chunk carries its own canaries and data hash. Push/pop check the
+// canaries of the chunk they touch, SegmentedVerify checks all of them.
+//
+// Chunks are reference counted (stack tops and prev links), so SegmentedClone
+// only takes a reference to the top chunk. A chain shared that way is never
+// written: push/pop copy the top chunk first if anyone else refers to it, so a
+// clone costs O(1) and afterwards one chunk per chunk actually modified.
+
+struct SegmentChunk_t
+{
+    ON_CANARY_PROTECTION(Canary_t        left_canary);
+                         SegmentChunk_t* prev;
+                         uint64_t        refs;
+    ON_HASH_PROTECTION(  uint64_t        DataHash);
+                         StackElem_t     data[SEGMENT_CHUNK_SIZE];
+    ON_CANARY_PROTECTION(Canary_t        right_canary);
+};
+
+struct SegmentedStack_t
+{
+    SegmentChunk_t* top;
+    SegmentChunk_t* spare;
+    uint64_t        used;   // elements in top
+    uint64_t        size;
+    FILE*           MemoryLogFile;
+};
+
+static SegmentChunk_t*   ChunkCtor           (SegmentedStack_t* segments);
+
+static StackReturnCode   ChunkPush           (SegmentedStack_t* segments);
+
+static StackReturnCode   ChunkPop            (SegmentedStack_t* segments);
+
+static StackReturnCode   ChunkIsDamaged      (const SegmentChunk_t* chunk);
+
+static StackReturnCode   ChunkOwn            (SegmentedStack_t* segments);
+
+static void              ChunkRetain         (SegmentChunk_t* chunk);
+
+static void              ChunkRelease        (SegmentedStack_t* segments, SegmentChunk_t* chunk);
+
+SegmentedStack_t* SegmentedCtor(FILE* MemoryLogFile)
+{
+    SegmentedStack_t* segments = (SegmentedStack_t*) log_calloc(MemoryLogFile, 1, sizeof(SegmentedStack_t));
+
+    if (!segments)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return nullptr;
+    }
+
+    segments->MemoryLogFile = MemoryLogFile;
+
+    segments->top = ChunkCtor(segments);
+
+    if (!segments->top)
+    {
+        log_free(MemoryLogFile, segments);
+
+        return nullptr;
+    }
+
+    return segments;
+}
+
+SegmentedStack_t* SegmentedClone(SegmentedStack_t* segments)
+{
+    SegmentedStack_t* clone = (SegmentedStack_t*) log_calloc(segments->MemoryLogFile, 1, sizeof(SegmentedStack_t));
+
+    if (!clone)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return nullptr;
+    }
+
+    *clone = *segments;
+
+    clone->spare = nullptr;
+
+    ChunkRetain(clone->top);
+
+    return clone;
+}
+
+StackReturnCode SegmentedPush(SegmentedStack_t* segments, StackElem_t value)
+{
+    if (segments->used == SEGMENT_CHUNK_SIZE && ChunkPush(segments) == FAILED)
+    {
+        return FAILED;
+    }
+
+    if (ChunkOwn(segments) == FAILED)
+    {
+        return FAILED;
+    }
+
+    SegmentChunk_t* chunk = segments->top;
+
+    if (ChunkIsDamaged(chunk) == STACK_DAMAGED)
+    {
+        return FAILED;
+    }
+
+    chunk->data[segments->used] = value;
+
+    ON_HASH_PROTECTION(chunk->DataHash += DataElemHash(value, segments->used));
+
+    segments->used++;
+
+    segments->size++;
+
+    return EXECUTED;
+}
+
+StackReturnCode SegmentedPop(SegmentedStack_t* segments, StackElem_t* value)
+{
+    if (segments->size == 0)
+    {
+        err |= STACK_UNDERFLOW;
+
+        return FAILED;
+    }
+
+    if (ChunkOwn(segments) == FAILED)
+    {
+        return FAILED;
+    }
+
+    SegmentChunk_t* chunk = segments->top;
+
+    if (ChunkIsDamaged(chunk) == STACK_DAMAGED)
+    {
+        return FAILED;
+    }
+
+    segments->used--;
+
+    segments->size--;
+
+    *value = chunk->data[segments->used];
+
+    chunk->data[segments->used] = POISON;
+
+    ON_HASH_PROTECTION(chunk->DataHash -= DataElemHash(*value, segments->used));
+
+    if (segments->used == 0 && chunk->prev)
+    {
+        return ChunkPop(segments);
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode SegmentedPushN(SegmentedStack_t* segments, const StackElem_t* values, size_t count)
+{
+    while (count > 0)
+    {
+        if (segments->used == SEGMENT_CHUNK_SIZE && ChunkPush(segments) == FAILED)
+        {
+            return FAILED;
+        }
+
+        if (ChunkOwn(segments) == FAILED)
+        {
+            return FAILED;
+        }
+
+        SegmentChunk_t* chunk = segments->top;
+
+        if (ChunkIsDamaged(chunk) == STACK_DAMAGED)
+        {
+            return FAILED;
+        }
+
+        size_t part = SEGMENT_CHUNK_SIZE - segments->used;
+
+        if (part > count)
+        {
+            part = count;
+        }
+
+        memcpy(chunk->data + segments->used, values, part * sizeof(StackElem_t));
+
+        #ifdef HASH_PROTECTION
+
+        for (size_t i = 0; i < part; i++)
+        {
+            chunk->DataHash += DataElemHash(values[i], segments->used + i);
+        }
+
+        #endif
+
+        segments->used += part;
+
+        segments->size += part;
+
+        values += part;
+
+        count  -= part;
+    }
+
+    return EXECUTED;
+}
+
+// Same order as StackPopN: values[count - 1] is the former top.
+
+StackReturnCode SegmentedPopN(SegmentedStack_t* segments, StackElem_t* values, size_t count)
+{
+    if (segments->size < count)
+    {
+        err |= STACK_UNDERFLOW;
+
+        return FAILED;
+    }
+
+    while (count > 0)
+    {
+        if (ChunkOwn(segments) == FAILED)
+        {
+            return FAILED;
+        }
+
+        SegmentChunk_t* chunk = segments->top;
+
+        if (ChunkIsDamaged(chunk) == STACK_DAMAGED)
+        {
+            return FAILED;
+        }
+
+        size_t part = segments->used < count ? segments->used : count;
+
+        segments->used -= part;
+
+        segments->size -= part;
+
+        count          -= part;
+
+        memcpy(values + count, chunk->data + segments->used, part * sizeof(StackElem_t));
+
+        memset((void*) (chunk->data + segments->used), POISON, part * sizeof(StackElem_t));
+
+        #ifdef HASH_PROTECTION
+
+        for (size_t i = 0; i < part; i++)
+        {
+            chunk->DataHash -= DataElemHash(values[count + i], segments->used + i);
+        }
+
+        #endif
+
+        if (segments->used == 0 && chunk->prev && ChunkPop(segments) == FAILED)
+        {
+            return FAILED;
+        }
+    }
+
+    return EXECUTED;
+}
+
+uint64_t SegmentedSize(const SegmentedStack_t* segments)
+{
+    return segments->size;
+}
+
+// Slots in the linked chunks, the spare not counted.
+
+uint64_t SegmentedCapacity(const SegmentedStack_t* segments)
+{
+    return segments->size - segments->used + SEGMENT_CHUNK_SIZE;
+}
+
+StackReturnCode SegmentedShrink(SegmentedStack_t* segments)
+{
+    if (segments->spare)
+    {
+        log_free(segments->MemoryLogFile, segments->spare);
+    }
+
+    segments->spare = nullptr;
+
+    return EXECUTED;
+}
+
+StackReturnCode SegmentedVerify(const SegmentedStack_t* segments)
+{
+    uint64_t used = segments->used;
+
+    for (const SegmentChunk_t* chunk = segments->top; chunk; chunk = chunk->prev)
+    {
+        if (ChunkIsDamaged(chunk) == STACK_DAMAGED)
+        {
+            return FAILED;
+        }
+
+        #ifdef HASH_PROTECTION
+
+        if (5831 + DataBlockHash(chunk->data, used, 0) != chunk->DataHash)
+        {
+            err |= INVALID_HASH;
+
+            return FAILED;
+        }
+
+        #endif
+
+        used = SEGMENT_CHUNK_SIZE;
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode SegmentedDtor(SegmentedStack_t* segments)
+{
+    if (!segments)
+    {
+        return FAILED;
+    }
+
+    ChunkRelease(segments, segments->top);
+
+    SegmentedShrink(segments);
+
+    log_free(segments->MemoryLogFile, segments);
+
+    return EXECUTED;
+}
+
+SegmentChunk_t* ChunkCtor(SegmentedStack_t* segments)
+{
+    SegmentChunk_t* chunk = (SegmentChunk_t*) log_calloc(segments->MemoryLogFile, 1, sizeof(SegmentChunk_t));
+
+    if (!chunk)
+    {
+        err |= INVALID_DATA_POINTER;
+
+        return nullptr;
+    }
+
+    ON_CANARY_PROTECTION(chunk->left_canary  = CANARY);
+
+    ON_CANARY_PROTECTION(chunk->right_canary = CANARY);
+
+    ON_HASH_PROTECTION(  chunk->DataHash     = 5831);
+
+    chunk->refs = 1;
+
+    return chunk;
+}
+
+// Links a fresh chunk on top of a full one, reusing the spare if there is one.
+
+StackReturnCode ChunkPush(SegmentedStack_t* segments)
+{
+    SegmentChunk_t* chunk = segments->spare;
+
+    segments->spare = nullptr;
+
+    if (!chunk)
+    {
+        if (segments->size + SEGMENT_CHUNK_SIZE > MAX_MAPPED_STACK_SIZE)
+        {
+            err |= STACK_OVERFLOW;
+
+            return FAILED;
+        }
+
+        chunk = ChunkCtor(segments);
+
+        if (!chunk)
+        {
+            return FAILED;
+        }
+    }
+
+    chunk->prev    = segments->top;
+
+    segments->top  = chunk;
+
+    segments->used = 0;
+
+    return EXECUTED;
+}
+
+// Unlinks an empty top chunk and keeps it as the spare.
+
+StackReturnCode ChunkPop(SegmentedStack_t* segments)
+{
+    SegmentChunk_t* chunk = segments->top;
+
+    SegmentedShrink(segments);
+
+    segments->top   = chunk->prev; // takes over the reference of chunk->prev
+
+    chunk->prev     = nullptr;
+
+    segments->spare = chunk;
+
+    segments->used  = SEGMENT_CHUNK_SIZE;
+
+    return EXECUTED;
+}
+
+StackReturnCode ChunkIsDamaged(const SegmentChunk_t* chunk)
+{
+    #ifdef CANARY_PROTECTION
+
+    if (chunk->left_canary != CANARY || chunk->right_canary != CANARY)
+    {
+        err |= INVALID_DATA_CANARY;
+
+        return STACK_DAMAGED;
+    }
+
+    #endif
+
+    (void) chunk;
+
+    return STACK_NOT_DAMAGED;
+}
+
+// Makes the top chunk private before it is written: a shared one is replaced by
+// a copy that refers to the same prev.
+
+StackReturnCode ChunkOwn(SegmentedStack_t* segments)
+{
+    SegmentChunk_t* chunk = segments->top;
+
+    if (__atomic_load_n(&chunk->refs, __ATOMIC_ACQUIRE) == 1)
+    {
+        return EXECUTED;
+    }
+
+    SegmentChunk_t* copy = segments->spare;
+
+    segments->spare = nullptr;
+
+    if (!copy)
+    {
+        copy = ChunkCtor(segments);
+
+        if (!copy)
+        {
+            return FAILED;
+        }
+    }
+
+    memcpy(copy, chunk, sizeof(SegmentChunk_t));
+
+    copy->refs = 1;
+
+    if (copy->prev)
+    {
+        ChunkRetain(copy->prev);
+    }
+
+    segments->top = copy;
+
+    ChunkRelease(segments, chunk);
+
+    return EXECUTED;
+}
+
+void ChunkRetain(SegmentChunk_t* chunk)
+{
+    __atomic_add_fetch(&chunk->refs, 1, __ATOMIC_RELAXED);
+}
+
+// Drops one reference and frees the chunks down the chain that nobody refers to
+// any more.
+
+void ChunkRelease(SegmentedStack_t* segments, SegmentChunk_t* chunk)
+{
+    while (chunk && __atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        SegmentChunk_t* prev = chunk->prev;
+
+        log_free(segments->MemoryLogFile, chunk);
+
+        chunk = prev;
+    }
+}
@@ -5,9 +5,18 @@
 #include <string.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "stack.h"
 #include "allocation.h"
+#include "lockfree.h"
+#include "elimination.h"
+#include "worksteal.h"
+#include "registry.h"
+#include "dumper.h"
+#include "hash.h"
+#include "segmented.h"
 
 
 struct Stack_t
@@ -20,7 +29,6 @@ struct Stack_t
     ON_DEBUG(            const char *    name);
     ON_HASH_PROTECTION(  uint64_t        DataHash);
     ON_HASH_PROTECTION(  uint64_t        StructHash);
-    ON_THREAD_PROTECTION(pthread_mutex_t mutex);
 
                          bool            inited;
                          StackId_t       id;
@@ -30,11 +38,21 @@ struct Stack_t
                          uint64_t        MemorySize;
                          uint64_t        size;
                          uint64_t        capacity;
+                         StackMode       mode;
+                         LockFreeStack_t* LockFree;
+                         EliminationArray_t* elimination;
+                         WorkStealDeque_t* deque;
+                         StackResizePolicy_t policy;
+                         uint64_t        reserved;
+                         StackStorage    storage;
+                         SegmentedStack_t* segments;
+                         bool            LazyPoison;
+                         uint64_t        touched;    // slots [touched, capacity) were never written
 
     ON_CANARY_PROTECTION(Canary_t        right_canary);
 };
 
-static Stack_t* STACKS[MAX_STACK_AMOUNT] = {nullptr};
+__thread uint64_t err = NO_ERROR;
 
 static int   STACK_AMOUNT  = 0;
 
@@ -42,552 +60,2204 @@ static FILE* MemoryLogFile = nullptr;
 
 static FILE* DumpFile      = nullptr;
 
-static StackReturnCode   StackIsDamaged      (StackId_t StackId, int line, const char* file, const char* function);
+ON_DEBUG(static pthread_mutex_t LogFilesMutex = PTHREAD_MUTEX_INITIALIZER);
 
-static StackReturnCode   StackIsValid        (StackId_t StackId ON_DEBUG(, int line, const char* file, const char* function));
+ON_DEBUG(static const char*     LogFilesMode  = "w");
 
-static void              StackAssert         (StackReturnCode code, int line, const char* file, const char* function);
+static StackStats_t RetiredStats = {}; // of the destroyed stacks, for StackGetTotalStats
 
-static StackReturnCode   CountDataHash       (StackId_t StackId);
+const uint64_t SCRUB_CHUNK   = 4096;    // elements StackScrub hashes per lock hold
 
-static StackReturnCode   CountStructHash     (StackId_t StackId);
+const int      SCRUB_RETRIES = 4;
 
-static StackReturnCode   StackDump           (Stack_t* stack, int line, const char* file, const char* function);
+static StackReturnCode   StackIsDamaged      (StackId_t StackId, int line, const char* file, const char* function);
 
-static StackReturnCode   StackResize         (StackId_t StackId, size_t newCapacity);
+static StackReturnCode   StackIsValid        (StackId_t StackId ON_DEBUG(, int line, const char* file, const char* function));
 
-StackId_t StackCtor(int capacity, int line, const char* file, const char* function)
-{
-    #ifdef DEBUG
+static StackReturnCode   StackCheckDamaged   (StackId_t StackId, bool before, int line, const char* file, const char* function);
 
-    if (!MemoryLogFile)
-    {
-        MemoryLogFile = fopen(MEMORY_LOG_FILE, "w");
-        ON_HTML(fprintf(MemoryLogFile, "<!DOCTYPE html><html>"));
-    }
+static void              StackCheckInit      (StackCheckState_t* check, const StackCheckPolicy_t* policy, StackId_t StackId);
 
-    if (!DumpFile)
-    {
-        DumpFile = fopen(DUMP_FILE, "w");
-        ON_HTML(fprintf(DumpFile, "<!DOCTYPE html><html>"));
-    };
+static inline bool       StackCheckDue       (StackCheckState_t* check);
 
-    #endif
+static inline uint64_t   CheckClock          (clockid_t clock);
 
-    StackId_t id = GetStackId();
+static void              StackRaise          (StackId_t StackId, uint64_t code);
 
-    if (id == INVALID_STACK_ID)
-    {
-        err += INVALID_STACK_ID_ERR;
+static void              StackNoteErr        (StackSlot_t* slot, uint64_t codes);
 
-        return INVALID_STACK_ID_ERR;
-    }
+static inline void       StatAdd             (uint64_t* counter, uint64_t value);
 
-    if (capacity < MIN_STACK_SIZE)
-    {
-        capacity = MIN_STACK_SIZE;
-    }
+static inline void       StatAddShared       (uint64_t* counter, uint64_t value);
 
-    #if defined(DEBUG) || defined(CANARY_PROTECTION)
+static inline void       StatAddOp           (const StackSlot_t* slot, uint64_t* counter, uint64_t value);
 
-    uint64_t MemorySize = ALIGNED_TO(sizeof(uint64_t), sizeof(Stack_t)) + ALIGNED_TO(sizeof(uint64_t), sizeof(Canary_t) + capacity * sizeof(StackElem_t)) + sizeof(Canary_t);
+static inline void       StatPeak            (uint64_t* peak, uint64_t size);
 
-    Stack_t* stack = (Stack_t*) log_calloc(MemoryLogFile, 1, MemorySize);
+static void              StatsAccumulate     (StackStats_t* total, const StackStats_t* stats);
 
-    #else
+static void              StatsPrint          (FILE* file, const char* name, const StackStats_t* stats);
 
-    uint64_t MemorySize = sizeof(Stack_t) + capacity * sizeof(StackElem_t);
+ON_THREAD_PROTECTION(static inline void StackLock     (StackSlot_t* slot));
 
-    Stack_t* stack = (Stack_t*) calloc(1, MemorySize);
+ON_THREAD_PROTECTION(static void        StackLockWait (StackSlot_t* slot));
 
-    #endif
+static void              StackAssert         (StackReturnCode code, int line, const char* file, const char* function);
 
-    *stack = {INIT(stack)};
+static StackReturnCode   CountDataHash       (StackId_t StackId);
 
-    stack->BornLine = line;
+static StackReturnCode   CountStructHash     (StackId_t StackId);
 
-    stack->BornFile = file;
+ON_HASH_PROTECTION(static uint64_t DataHashOf   (const StackElem_t* data, uint64_t size));
 
-    stack->BornFunc = function;
+ON_HASH_PROTECTION(static uint64_t StructHashOf (const Stack_t* stack));
 
-    ON_THREAD_PROTECTION(pthread_mutex_init(&(stack->mutex), NULL));
+ON_HASH_PROTECTION(static StackReturnCode ScrubDataHash(StackId_t StackId, StackSlot_t* slot));
 
-    if (!stack)
+static StackReturnCode   StackDump           (Stack_t* stack, int line, const char* file, const char* function);
 
-    {
-        err += INVALID_STACK_POINTER;
+static StackReturnCode   StackResize         (StackId_t StackId, size_t newCapacity);
 
-        return INVALID_STACK_POINTER;
-    }
+static uint64_t          GrowCapacity        (const Stack_t* stack, uint64_t needed);
 
-    #if defined(DEBUG) || defined(CANARY_PROTECTION)
+static inline uint64_t   MaxCapacity         (const Stack_t* stack);
 
-    stack->MemorySize = MemorySize;
+static Stack_t*          StackAlloc          (const StackOptions_t* options, uint64_t MemorySize);
 
-    stack->DataLeftCanary = (Canary_t*) (stack + 1);
+static Stack_t*          StackRealloc        (Stack_t* stack, uint64_t MemorySize);
 
-    *(stack->DataLeftCanary) = CANARY;
+static void              StackFree           (Stack_t* stack);
 
-    stack->DataRightCanary = (Canary_t*)((char*) stack + stack->MemorySize - sizeof(Canary_t));
+static uint64_t          ShrinkCapacity      (const Stack_t* stack);
 
-    *(stack->DataRightCanary) = CANARY;
+static inline bool       IsMapped            (StackStorage storage);
 
-    stack->data = (StackElem_t*)((char*) stack->DataLeftCanary + sizeof(Canary_t));
+static uint64_t          FileLayout          ();
 
-    #else
+static void              StackAttach         (Stack_t* stack, StackId_t id, const StackCheckPolicy_t* check);
 
-    stack->data = (StackElem_t*) (stack + 1);
+static StackId_t         StackCopy           (StackId_t StackId, bool frozen, int line, const char* file, const char* function);
 
-    #endif
+static StackId_t         StackShare          (StackId_t StackId, int line, const char* file, const char* function);
 
-    if (!stack->data)
-    {
-        err += INVALID_DATA_POINTER;
+static void              StackRebase         (Stack_t* stack);
 
-        return INVALID_STACK_ID;
-    }
+ON_DEBUG(static void     LogFilesOpen        ());
 
-    memset((void*) stack->data, POISON, capacity * sizeof(StackElem_t));
+static inline Stack_t*   GetStack            (StackId_t StackId);
 
-    stack->size = 0;
+static inline pthread_mutex_t* StackMutex    (StackId_t StackId);
 
-    stack->capacity = capacity;
+#ifdef GUARD_PROTECTION
 
-    stack->inited = true;
+const size_t             GUARD_REPORT_SIZE = 512;
 
-    stack->id = id;
+static pthread_once_t    GuardOnce = PTHREAD_ONCE_INIT;
 
-    STACKS[id - 1] = stack;
+static struct sigaction  GuardPrevAction = {};
 
-    STACK_AMOUNT++;
+static void              GuardInstall        ();
 
-    ON_HASH_PROTECTION(CountDataHash(  id));
+static void              GuardHandler        (int signal, siginfo_t* info, void* context);
 
-    ON_HASH_PROTECTION(CountStructHash(id));
+static bool              GuardMatch          (const StackSlot_t* slot, const void* address);
 
-    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+static size_t            GuardAppend         (char* report, size_t length, const char* text);
 
-    return stack->id;
-}
+static size_t            GuardAppendNumber   (char* report, size_t length, uint64_t value, unsigned base);
 
-StackId_t GetStackId()
-{
-    StackId_t ReturnId = INVALID_STACK_ID;
+#endif
 
-    StackId_t id = 0;
+StackId_t StackCtor(int capacity, int line, const char* file, const char* function)
+{
+    return StackCtorEx(capacity, &DEFAULT_STACK_OPTIONS, line, file, function);
+}
 
-    for (id; id < MAX_STACK_AMOUNT; id++)
+StackId_t StackCtorEx(int capacity, const StackOptions_t* options, int line, const char* file, const char* function)
+{
+    if (options->storage == STACK_STORAGE_FILE && (!options->path || options->mode != STACK_MODE_LOCKED))
     {
-        if (STACKS[id] == nullptr)
-        {
-            ReturnId = id + 1;
-            break;
-        }
-    }
+        err |= INVALID_FILE_POINTER;
 
-    return ReturnId;
-}
+        return INVALID_STACK_ID;
+    }
 
-StackReturnCode StackPush(StackId_t StackId, StackElem_t value)
-{
-    Stack_t* stack = STACKS[StackId - 1];
+    if (options->storage == STACK_STORAGE_SEGMENTED && options->mode != STACK_MODE_LOCKED)
+    {
+        err |= INVALID_STACK_POINTER; // lock-free and work-stealing stacks keep their own storage
 
-    STACK_ASSERT(STACK_IS_VALID(StackId));
+        return INVALID_STACK_ID;
+    }
 
-    ON_THREAD_PROTECTION(pthread_mutex_lock(&(stack->mutex)));
+    ON_DEBUG(LogFilesOpen());
 
-    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+    ON_GUARD_PROTECTION(pthread_once(&GuardOnce, GuardInstall));
 
-    if (stack->size < stack->capacity)
+    if (capacity < MIN_STACK_SIZE)
     {
-        stack->data[stack->size] = value;
+        capacity = MIN_STACK_SIZE;
     }
-    else
+
+    EliminationArray_t* elimination = nullptr;
+
+    if (options->elimination)
     {
-        if (stack->capacity > MAX_STACK_SIZE)
+        elimination = EliminationCtor(MemoryLogFile);
+
+        if (!elimination)
         {
-            err += STACK_OVERFLOW;
+            return INVALID_STACK_ID;
+        }
+    }
 
-            ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+    LockFreeStack_t* LockFree = nullptr;
 
-            return FAILED;
-        }
+    if (options->mode == STACK_MODE_LOCK_FREE)
+    {
+        LockFree = LockFreeCtor(capacity, elimination, MemoryLogFile);
 
-        if (StackResize(StackId, stack->capacity * 2) == FAILED)
+        if (!LockFree)
         {
-            ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+            EliminationDtor(elimination);
 
-            return FAILED;
+            return INVALID_STACK_ID;
         }
 
-        stack = STACKS[StackId - 1];
-
-        stack->data[stack->size] = value;
+        capacity = MIN_STACK_SIZE; // elements live in LockFree, data stays unused
     }
 
-    stack->size++;
+    WorkStealDeque_t* deque = nullptr;
 
-    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+    if (options->mode == STACK_MODE_WORK_STEALING)
+    {
+        deque = WorkStealCtor(capacity, MemoryLogFile);
 
-    ON_HASH_PROTECTION(CountDataHash(  StackId));
+        if (!deque)
+        {
+            EliminationDtor(elimination);
 
-    ON_HASH_PROTECTION(CountStructHash(StackId));
+            return INVALID_STACK_ID;
+        }
 
-    STACK_ASSERT(STACK_IS_VALID(  StackId));
+        capacity = MIN_STACK_SIZE; // elements live in deque, data stays unused
+    }
 
-    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+    SegmentedStack_t* segments = nullptr;
 
-    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+    if (options->storage == STACK_STORAGE_SEGMENTED)
+    {
+        segments = SegmentedCtor(MemoryLogFile);
 
-    return EXECUTED;
-}
+        if (!segments)
+        {
+            EliminationDtor(elimination);
 
-StackElem_t StackPop(StackId_t StackId)
-{
-    Stack_t* stack = STACKS[StackId - 1];
+            return INVALID_STACK_ID;
+        }
 
-    STACK_ASSERT(STACK_IS_VALID(StackId));
+        capacity = MIN_STACK_SIZE; // elements live in chunks, data stays unused
+    }
 
-    ON_THREAD_PROTECTION(pthread_mutex_lock(&(stack->mutex)));
+    #if defined(DEBUG) || defined(CANARY_PROTECTION)
 
-    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+    uint64_t MemorySize = ALIGNED_TO(sizeof(uint64_t), sizeof(Stack_t)) + ALIGNED_TO(sizeof(uint64_t), sizeof(Canary_t) + capacity * sizeof(StackElem_t)) + sizeof(Canary_t);
 
-    if (stack->size == 0)
-    {
-        err += STACK_UNDERFLOW;
+    #else
+
+    uint64_t MemorySize = sizeof(Stack_t) + capacity * sizeof(StackElem_t);
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+    #endif
 
-        return FAILED;
-    }
+    Stack_t* stack = StackAlloc(options, MemorySize);
 
-    stack->size--;
+    if (!stack)
+    {
+        err |= INVALID_STACK_POINTER;
 
-    ON_HASH_PROTECTION(CountStructHash(StackId));
+        LockFreeDtor(LockFree);
 
-    StackElem_t value = stack->data[stack->size];
+        WorkStealDtor(deque);
 
-    if ((stack->size <= stack->capacity / 4) && (stack->capacity / 2 >= MIN_STACK_SIZE))
-    {
-        if (StackResize(StackId, stack->capacity / 2) == FAILED)
-        {
-            ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        SegmentedDtor(segments);
 
-            return FAILED;
-        }
+        EliminationDtor(elimination);
+
+        return INVALID_STACK_ID;
     }
 
-    stack = STACKS[StackId - 1];
+    *stack = {INIT(stack)};
 
-    stack->data[stack->size] = POISON;
+    ON_DEBUG(stack->BornLine = line);
 
-    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+    ON_DEBUG(stack->BornFile = file);
 
-    ON_HASH_PROTECTION(CountDataHash(  StackId));
+    ON_DEBUG(stack->BornFunc = function);
 
-    ON_HASH_PROTECTION(CountStructHash(StackId));
+    #if defined(DEBUG) || defined(CANARY_PROTECTION)
 
-    STACK_ASSERT(STACK_IS_VALID(  StackId));
+    stack->MemorySize = MemorySize;
 
-    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+    stack->DataLeftCanary = (Canary_t*) (stack + 1);
 
-    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+    *(stack->DataLeftCanary) = CANARY;
 
-    return value;
-}
+    stack->DataRightCanary = (Canary_t*)((char*) stack + stack->MemorySize - sizeof(Canary_t));
 
+    *(stack->DataRightCanary) = CANARY;
 
-StackReturnCode StackResize(StackId_t StackId, size_t NewCapacity)
-{
-    Stack_t* stack = STACKS[StackId - 1];
+    stack->data = (StackElem_t*)((char*) stack->DataLeftCanary + sizeof(Canary_t));
 
-    STACK_ASSERT(STACK_IS_VALID(StackId));
+    #else
 
-    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+    stack->data = (StackElem_t*) (stack + 1);
 
-    if (NewCapacity < MIN_STACK_SIZE)
+    #endif
+
+    if (!stack->data)
     {
-        err += REQUESTED_TOO_LITTLE;
+        err |= INVALID_DATA_POINTER;
 
-        return FAILED;
+        return INVALID_STACK_ID;
     }
 
-    if (NewCapacity > MAX_STACK_SIZE)
+    if (options->LazyPoison)
     {
-        err += REQUESTED_TOO_MUCH;
-
-        return FAILED;
+        stack->touched = 0;
     }
-
-    #if defined(DEBUG) || defined(CANARY_PROTECTION)
-
-    uint64_t NewMemorySize = ALIGNED_TO(sizeof(uint64_t), sizeof(Stack_t)) + \
-                             ALIGNED_TO(sizeof(uint64_t), sizeof(Canary_t) + \
-                             NewCapacity * sizeof(StackElem_t)) + sizeof(Canary_t);
-
-    stack = (Stack_t*) log_realloc(MemoryLogFile, stack, NewMemorySize);
-
-    if (!(stack))
+    else
     {
-        err += INVALID_STACK_POINTER;
+        memset((void*) stack->data, POISON, capacity * sizeof(StackElem_t));
 
-        return FAILED;
+        stack->touched = (uint64_t) capacity;
     }
 
-    stack->DataLeftCanary = (Canary_t*) (stack + 1);
+    stack->size = 0;
 
-    stack->data = (StackElem_t*)((char*) stack->DataLeftCanary + sizeof(Canary_t));
+    stack->capacity = capacity;
 
-    *((Canary_t*)((char*) stack + stack->MemorySize - sizeof(Canary_t))) = 0; // null previous r_canary
+    stack->LazyPoison = options->LazyPoison;
 
-    stack->MemorySize = NewMemorySize;
+    stack->mode = options->mode;
 
-    stack->capacity   = NewCapacity;
+    stack->LockFree = LockFree;
 
-    stack->DataRightCanary = (Canary_t*) ((char*) stack + NewMemorySize - sizeof(Canary_t));
+    stack->elimination = elimination;
 
-    *(stack->DataRightCanary) = CANARY;
+    stack->deque = deque;
 
-    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+    stack->storage = options->storage;
 
-    #else
+    stack->segments = segments;
 
-    uint64_t NewMemorySize = sizeof(Stack_t) + NewCapacity * sizeof(StackElem_t);
+    stack->policy = options->policy;
 
-    stack = (Stack_t*) realloc(stack, NewMemorySize);
+    if (stack->policy.GrowthFactor <= 1)
+    {
+        stack->policy.GrowthFactor = 2;
+    }
 
-    if (!(stack))
+    if (stack->policy.ShrinkLoad <= 0 || stack->policy.ShrinkLoad >= 1)
     {
-        err += INVALID_STACK_POINTER;
+        stack->policy.ShrinkLoad = 0.25;
+    }
 
-        return FAILED;
+    if (stack->policy.MinCapacity < MIN_STACK_SIZE)
+    {
+        stack->policy.MinCapacity = MIN_STACK_SIZE;
     }
 
-    stack->data = (StackElem_t*) (stack + 1);
+    StackId_t id = GetStackId();
 
-    stack->MemorySize = NewMemorySize;
+    if (id == INVALID_STACK_ID)
+    {
+        err |= INVALID_STACK_ID_ERR;
 
-    stack->capacity = NewCapacity;
+        LockFreeDtor(LockFree);
 
-    #endif
+        WorkStealDtor(deque);
 
-    STACKS[StackId - 1] = stack;
+        SegmentedDtor(segments);
 
-    ON_HASH_PROTECTION(CountDataHash(  StackId));
+        EliminationDtor(elimination);
 
-    ON_HASH_PROTECTION(CountStructHash(StackId));
+        StackFree(stack);
 
-    STACK_ASSERT(STACK_IS_VALID(  StackId));
+        return INVALID_STACK_ID;
+    }
 
-    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+    StackAttach(stack, id, &(options->check));
 
-    return EXECUTED;
+    ON_HASH_PROTECTION(CountDataHash(  id));
+
+    ON_HASH_PROTECTION(CountStructHash(id));
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    return stack->id;
 }
 
-StackReturnCode StackDtor(StackId_t StackId)
-{
-    Stack_t* stack = STACKS[StackId - 1];
+// Maps a STACK_STORAGE_FILE stack back in. Only the struct is checked here: its
+// canaries and, under HASH_PROTECTION, the struct hash it was closed with. The
+// elements are left to the first full StackVerify or StackDtor, as if all checks
+// since had been skipped, so opening costs the same for any size.
 
-    if (!stack)
+StackId_t StackOpen(const char* path, int line, const char* file, const char* function)
+{
+    if (!path)
     {
-        return FAILED;
+        err |= INVALID_FILE_POINTER;
+
+        return INVALID_STACK_ID;
     }
 
-    ON_THREAD_PROTECTION(pthread_mutex_lock(&(stack->mutex)));
+    ON_DEBUG(LogFilesOpen());
 
-    memset(stack, 0, stack->MemorySize);
+    ON_GUARD_PROTECTION(pthread_once(&GuardOnce, GuardInstall));
 
-    #ifdef DEBUG
+    uint64_t ReserveSize = sizeof(Stack_t) + 3 * sizeof(Canary_t) + ((uint64_t) MAX_MAPPED_STACK_SIZE + 1) * sizeof(StackElem_t);
 
-    log_free(MemoryLogFile, stack);
+    Stack_t* stack = (Stack_t*) file_open(path, FileLayout(), ReserveSize);
 
-    if (STACK_AMOUNT == 0)
+    if (!stack)
     {
-        if (MemoryLogFile)
-        {
-            ON_HTML(fprintf(MemoryLogFile, "</html>\n"));
+        err |= INVALID_FILE_POINTER;
 
-            fclose(MemoryLogFile);
-        }
+        return INVALID_STACK_ID;
+    }
 
-        if (DumpFile)
-        {
-            ON_HTML(fprintf(DumpFile, "</html>\n"));
+    #if defined(DEBUG) || defined(CANARY_PROTECTION)
 
-            fclose(DumpFile);
-        }
-    }
+    uint64_t MemorySize = ALIGNED_TO(sizeof(uint64_t), sizeof(Stack_t)) + ALIGNED_TO(sizeof(uint64_t), sizeof(Canary_t) + stack->capacity * sizeof(StackElem_t)) + sizeof(Canary_t);
 
     #else
 
-    free(stack);
+    uint64_t MemorySize = sizeof(Stack_t) + stack->capacity * sizeof(StackElem_t);
 
     #endif
 
-    #ifdef THREAD_PROTECTION
-
-    pthread_mutex_unlock(&(stack->mutex));
+    uint64_t code = NO_ERROR;
 
-    if (&(stack->mutex))
+    if (stack->storage != STACK_STORAGE_FILE || stack->mode != STACK_MODE_LOCKED ||
+        stack->capacity > MAX_MAPPED_STACK_SIZE || stack->size > stack->capacity || stack->touched > stack->capacity ||
+        stack->MemorySize != MemorySize)
     {
-        pthread_mutex_destroy(&(stack->mutex));
+        code += INVALID_SIZE;
     }
 
-    #endif
+    ON_CANARY_PROTECTION(code += (stack->left_canary != CANARY || stack->right_canary != CANARY) ? INVALID_STRUCT_CANARY : NO_ERROR);
 
-    stack = nullptr;
+    ON_HASH_PROTECTION(  code += StructHashOf(stack) != stack->StructHash                        ? INVALID_HASH          : NO_ERROR);
 
-    STACKS[StackId - 1] = nullptr;
+    if (code != NO_ERROR)
+    {
+        err |= code;
 
-    return EXECUTED;
-}
+        file_free(stack);
 
-StackReturnCode StackDump(Stack_t* stack ON_DEBUG(, int line, const char* file, const char* function))
-{
-    #ifdef DEBUG
+        return INVALID_STACK_ID;
+    }
+
+    StackRebase(stack); // pointers are only valid in the process that wrote them
+
+    ON_DEBUG(stack->BornLine = line);
+
+    ON_DEBUG(stack->BornFile = file);
+
+    ON_DEBUG(stack->BornFunc = function);
+
+    ON_DEBUG(stack->name     = "stack");
+
+    stack->LockFree    = nullptr;
+
+    stack->elimination = nullptr;
+
+    stack->deque       = nullptr;
+
+    stack->segments    = nullptr;
+
+    StackId_t id = GetStackId();
+
+    if (id == INVALID_STACK_ID)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        file_free(stack);
+
+        return INVALID_STACK_ID;
+    }
+
+    StackAttach(stack, id, &(DEFAULT_STACK_OPTIONS.check));
+
+    RegistryGet(id)->check.pending = true;
+
+    ON_HASH_PROTECTION(CountStructHash(id));
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    return id;
+}
+
+StackId_t StackClone(StackId_t StackId, int line, const char* file, const char* function)
+{
+    return StackCopy(StackId, false, line, file, function);
+}
+
+StackId_t StackSnapshot(StackId_t StackId, int line, const char* file, const char* function)
+{
+    return StackCopy(StackId, true, line, file, function);
+}
+
+// A segmented stack is cloned by sharing its chunks, see SegmentedClone, and a
+// mapped one by sharing its pages, see StackShare. Other locked stacks have one
+// contiguous block and are copied with a single PushN.
+
+StackId_t StackCopy(StackId_t StackId, bool frozen, int line, const char* file, const char* function)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return INVALID_STACK_ID;
+    }
+
+    if (slot->mode != STACK_MODE_LOCKED)
+    {
+        StackRaise(StackId, INVALID_STACK_POINTER);
+
+        return INVALID_STACK_ID;
+    }
+
+    Stack_t* stack = GetStack(StackId);
+
+    if (stack->storage == STACK_STORAGE_MAPPED)
+    {
+        StackId_t id = StackShare(StackId, line, file, function);
+
+        if (id != INVALID_STACK_ID)
+        {
+            RegistryGet(id)->frozen = frozen;
+
+            return id;
+        }
+    }
+
+    StackOptions_t options = DEFAULT_STACK_OPTIONS;
+
+    options.policy  = stack->policy;
+
+    options.storage = stack->storage == STACK_STORAGE_FILE ? STACK_STORAGE_MAPPED : stack->storage;
+
+    options.check   = slot->check.policy;
+
+    options.LazyPoison = stack->LazyPoison;
+
+    StackId_t id = StackCtorEx((int) stack->capacity, &options, line, file, function);
+
+    if (id == INVALID_STACK_ID)
+    {
+        return INVALID_STACK_ID;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_BEFORE(StackId));
+
+    StackReturnCode code = EXECUTED;
+
+    if (stack->segments)
+    {
+        SegmentedStack_t* segments = SegmentedClone(stack->segments);
+
+        Stack_t* copy = GetStack(id);
+
+        if (segments)
+        {
+            SegmentedDtor(copy->segments);
+
+            copy->segments = segments;
+
+            ON_HASH_PROTECTION(CountStructHash(id));
+        }
+        else
+        {
+            code = FAILED;
+        }
+    }
+    else
+    {
+        code = StackPushN(id, stack->data, stack->size);
+    }
+
+    STACK_ASSERT(STACK_CHECK_AFTER( StackId));
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+    if (code == FAILED)
+    {
+        StackDtor(id);
+
+        return INVALID_STACK_ID;
+    }
+
+    RegistryGet(id)->frozen = frozen;
+
+    return id;
+}
+
+// The copy is a copy-on-write view of the same pages (mapped_clone), so only the
+// pages either side writes to later are copied. Returns INVALID_STACK_ID without
+// raising anything if the block cannot be shared; StackCopy then copies it.
+
+StackId_t StackShare(StackId_t StackId, int line, const char* file, const char* function)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_BEFORE(StackId));
+
+    Stack_t* copy = (Stack_t*) mapped_clone(stack);
+
+    STACK_ASSERT(STACK_CHECK_AFTER( StackId));
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+    if (!copy)
+    {
+        return INVALID_STACK_ID;
+    }
+
+    StackRebase(copy);
+
+    ON_DEBUG(copy->BornLine = line);
+
+    ON_DEBUG(copy->BornFile = file);
+
+    ON_DEBUG(copy->BornFunc = function);
+
+    copy->elimination = nullptr;
+
+    copy->reserved    = 0;
+
+    StackId_t id = GetStackId();
+
+    if (id == INVALID_STACK_ID)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        mapped_free(copy);
+
+        return INVALID_STACK_ID;
+    }
+
+    StackAttach(copy, id, &(slot->check.policy));
+
+    ON_HASH_PROTECTION(CountStructHash(id));
+
+    ON_DEBUG(StackDump(copy, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    return id;
+}
+
+// Points data and the data canaries into the block, after it was mapped at a new
+// address.
+
+void StackRebase(Stack_t* stack)
+{
+    #if defined(DEBUG) || defined(CANARY_PROTECTION)
+
+    stack->DataLeftCanary  = (Canary_t*) (stack + 1);
+
+    stack->DataRightCanary = (Canary_t*) ((char*) stack + stack->MemorySize - sizeof(Canary_t));
+
+    stack->data = (StackElem_t*) ((char*) stack->DataLeftCanary + sizeof(Canary_t));
+
+    #else
+
+    stack->data = (StackElem_t*) (stack + 1);
+
+    #endif
+}
+
+#ifdef DEBUG
+
+void LogFilesOpen()
+{
+    pthread_mutex_lock(&LogFilesMutex);
+
+    if (!MemoryLogFile)
+    {
+        MemoryLogFile = fopen(MEMORY_LOG_FILE, LogFilesMode);
+        ON_HTML(fprintf(MemoryLogFile, "<!DOCTYPE html><html>"));
+    }
 
     if (!DumpFile)
     {
-        fprintf(stderr, "INVALID FILE POINTER\n");
+        DumpFile = fopen(DUMP_FILE, LogFilesMode);
+
+        #ifdef BINARY_DUMP
+
+        TraceStart(DumpFile);
+
+        #else
+
+        ON_HTML(fprintf(DumpFile, "<!DOCTYPE html><html>"));
+
+        #endif
+
+        #ifdef ASYNC_DUMP
+
+        DumpAsyncStart(DumpFile);
+
+        #endif
+    };
+
+    LogFilesMode = "a"; // reopened after the last StackDtor closed them
+
+    pthread_mutex_unlock(&LogFilesMutex);
+}
+
+#endif
+
+// Registers a constructed or reopened stack under id and publishes it.
+
+void StackAttach(Stack_t* stack, StackId_t id, const StackCheckPolicy_t* check)
+{
+    stack->inited = true;
+
+    stack->id = id;
+
+    StackSlot_t* slot = RegistryGet(id);
+
+    slot->mode        = stack->mode;
+
+    slot->elimination = stack->elimination;
+
+    StackCheckInit(&(slot->check), check, id);
+
+    memset(&(slot->stats), 0, sizeof(StackStats_t));
+
+    slot->errors = NO_ERROR;
+
+    slot->frozen = false;
+
+    __atomic_store_n(&slot->stack, stack, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&STACK_AMOUNT, 1, __ATOMIC_RELAXED);
+}
+
+StackId_t GetStackId()
+{
+    return RegistryAcquire();
+}
+
+Stack_t* GetStack(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    return slot ? __atomic_load_n(&slot->stack, __ATOMIC_ACQUIRE) : nullptr;
+}
+
+pthread_mutex_t* StackMutex(StackId_t StackId)
+{
+    return &(RegistryGet(StackId)->mutex);
+}
+
+StackReturnCode StackPush(StackId_t StackId, StackElem_t value)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    if (slot->frozen)
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    if (slot->mode == STACK_MODE_LOCK_FREE || slot->mode == STACK_MODE_WORK_STEALING)
+    {
+        Stack_t* stack = GetStack(StackId);
+
+        uint64_t OldErr = err;
+
+        StackReturnCode code = slot->mode == STACK_MODE_LOCK_FREE ? LockFreePush( stack->LockFree, value) :
+                                                                    WorkStealPush(stack->deque,    value);
+
+        if (code == EXECUTED)
+        {
+            StatAddShared(&(slot->stats.pushes), 1);
+        }
+        else
+        {
+            StackNoteErr(slot, err & ~OldErr);
+        }
+
+        return code;
+    }
+
+    #ifdef THREAD_PROTECTION
+
+    if (pthread_mutex_trylock(&(slot->mutex)) != 0)
+    {
+        if (slot->elimination && EliminationPush(slot->elimination, value) == EXECUTED)
+        {
+            StatAddShared(&(slot->stats.pushes), 1);
+
+            return EXECUTED;
+        }
+
+        StackLockWait(slot);
+    }
+
+    #endif
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_BEFORE(StackId));
+
+    if (stack->segments)
+    {
+        uint64_t OldErr = err;
+
+        StackReturnCode code = SegmentedPush(stack->segments, value);
+
+        if (code == FAILED)
+        {
+            StackNoteErr(slot, err & ~OldErr);
+        }
+
+        if (code == EXECUTED)
+        {
+            StatAddOp(slot, &(slot->stats.pushes), 1);
+
+            StatPeak(&(slot->stats.PeakSize), SegmentedSize(stack->segments));
+        }
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return code;
+    }
+
+    if (stack->size < stack->capacity)
+    {
+        stack->data[stack->size] = value;
+    }
+    else
+    {
+        if (stack->capacity >= MaxCapacity(stack))
+        {
+            StackRaise(StackId, STACK_OVERFLOW);
+
+            ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+            return FAILED;
+        }
+
+        if (StackResize(StackId, GrowCapacity(stack, stack->size + 1)) == FAILED)
+        {
+            ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+            return FAILED;
+        }
+
+        stack = GetStack(StackId);
+
+        stack->data[stack->size] = value;
+    }
+
+    ON_HASH_PROTECTION(stack->DataHash += DataElemHash(value, stack->size));
+
+    stack->size++;
+
+    if (stack->size > stack->touched)
+    {
+        stack->touched = stack->size;
+    }
+
+    StatAddOp(slot, &(slot->stats.pushes), 1);
+
+    StatPeak(&(slot->stats.PeakSize), stack->size);
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_AFTER( StackId));
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+    return EXECUTED;
+}
+
+StackElem_t StackPop(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    if (slot->frozen)
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    if (slot->mode == STACK_MODE_LOCK_FREE || slot->mode == STACK_MODE_WORK_STEALING)
+    {
+        Stack_t* stack = GetStack(StackId);
+
+        StackElem_t value = 0;
+
+        uint64_t OldErr = err;
+
+        StackReturnCode code = slot->mode == STACK_MODE_LOCK_FREE ? LockFreePop( stack->LockFree, &value) :
+                                                                    WorkStealPop(stack->deque,    &value);
+
+        if (code == FAILED)
+        {
+            StackNoteErr(slot, err & ~OldErr);
+
+            StatAddShared(&(slot->stats.underflows), 1);
+
+            return FAILED;
+        }
+
+        StatAddShared(&(slot->stats.pops), 1);
+
+        return value;
+    }
+
+    #ifdef THREAD_PROTECTION
+
+    if (pthread_mutex_trylock(&(slot->mutex)) != 0)
+    {
+        StackElem_t value = 0;
+
+        if (slot->elimination && EliminationPop(slot->elimination, &value) == EXECUTED)
+        {
+            StatAddShared(&(slot->stats.pops), 1);
+
+            return value;
+        }
+
+        StackLockWait(slot);
+    }
+
+    #endif
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_BEFORE(StackId));
+
+    if (stack->segments)
+    {
+        StackElem_t value = 0;
+
+        uint64_t OldErr = err;
+
+        StackReturnCode code = SegmentedPop(stack->segments, &value);
+
+        if (code == FAILED)
+        {
+            StackNoteErr(slot, err & ~OldErr);
+        }
+
+        StatAddOp(slot, code == EXECUTED ? &(slot->stats.pops) : &(slot->stats.underflows), 1);
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return code == EXECUTED ? value : FAILED;
+    }
+
+    if (stack->size == 0)
+    {
+        StackRaise(StackId, STACK_UNDERFLOW);
+
+        StatAdd(&(slot->stats.underflows), 1);
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    stack->size--;
+
+    StatAddOp(slot, &(slot->stats.pops), 1);
+
+    StackElem_t value = stack->data[stack->size];
+
+    ON_HASH_PROTECTION(stack->DataHash -= DataElemHash(value, stack->size));
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    uint64_t NewCapacity = ShrinkCapacity(stack);
+
+    if (NewCapacity != stack->capacity && StackResize(StackId, NewCapacity) == FAILED)
+    {
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    stack = GetStack(StackId);
+
+    stack->data[stack->size] = POISON;
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_AFTER( StackId));
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+    return value;
+}
+
+StackReturnCode StackPushN(StackId_t StackId, const StackElem_t* values, size_t count)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    if (slot->frozen)
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    if (slot->mode != STACK_MODE_LOCKED)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (StackPush(StackId, values[i]) == FAILED)
+            {
+                return FAILED;
+            }
+        }
+
+        return EXECUTED;
+    }
+
+    ON_THREAD_PROTECTION(StackLock(slot));
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_BEFORE(StackId));
+
+    if (stack->segments)
+    {
+        uint64_t OldErr = err;
+
+        StackReturnCode code = SegmentedPushN(stack->segments, values, count);
+
+        if (code == FAILED)
+        {
+            StackNoteErr(slot, err & ~OldErr);
+        }
+
+        if (code == EXECUTED)
+        {
+            StatAddOp(slot, &(slot->stats.pushes), count);
+
+            StatPeak(&(slot->stats.PeakSize), SegmentedSize(stack->segments));
+        }
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return code;
+    }
+
+    if (stack->size + count > stack->capacity)
+    {
+        if (stack->size + count > MaxCapacity(stack))
+        {
+            StackRaise(StackId, STACK_OVERFLOW);
+
+            ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+            return FAILED;
+        }
+
+        if (StackResize(StackId, GrowCapacity(stack, stack->size + count)) == FAILED)
+        {
+            ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+            return FAILED;
+        }
+
+        stack = GetStack(StackId);
+    }
+
+    memcpy(stack->data + stack->size, values, count * sizeof(StackElem_t));
+
+    #ifdef HASH_PROTECTION
+
+    for (size_t i = 0; i < count; i++)
+    {
+        stack->DataHash += DataElemHash(values[i], stack->size + i);
+    }
+
+    #endif
+
+    stack->size += count;
+
+    if (stack->size > stack->touched)
+    {
+        stack->touched = stack->size;
+    }
+
+    StatAddOp(slot, &(slot->stats.pushes), count);
+
+    StatPeak(&(slot->stats.PeakSize), stack->size);
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_AFTER( StackId));
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+    return EXECUTED;
+}
+
+// Pops the top count elements in stack order: values[count - 1] is the former top,
+// so StackPopN undoes a StackPushN of the same array.
+
+StackReturnCode StackPopN(StackId_t StackId, StackElem_t* values, size_t count)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    if (slot->frozen)
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    if (slot->mode != STACK_MODE_LOCKED)
+    {
+        for (size_t i = count; i > 0; i--)
+        {
+            uint64_t OldErr = err;
+
+            err = NO_ERROR; // a code already set would not show up again
+
+            values[i - 1] = StackPop(StackId);
+
+            bool failed = err != NO_ERROR;
+
+            err |= OldErr;
+
+            if (failed)
+            {
+                return FAILED;
+            }
+        }
+
+        return EXECUTED;
+    }
+
+    ON_THREAD_PROTECTION(StackLock(slot));
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_BEFORE(StackId));
+
+    if (stack->segments)
+    {
+        uint64_t OldErr = err;
+
+        StackReturnCode code = SegmentedPopN(stack->segments, values, count);
+
+        if (code == FAILED)
+        {
+            StackNoteErr(slot, err & ~OldErr);
+        }
+
+        StatAddOp(slot, code == EXECUTED ? &(slot->stats.pops) : &(slot->stats.underflows), code == EXECUTED ? count : 1);
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return code;
+    }
+
+    if (stack->size < count)
+    {
+        StackRaise(StackId, STACK_UNDERFLOW);
+
+        StatAdd(&(slot->stats.underflows), 1);
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    stack->size -= count;
+
+    StatAddOp(slot, &(slot->stats.pops), count);
+
+    memcpy(values, stack->data + stack->size, count * sizeof(StackElem_t));
+
+    memset((void*) (stack->data + stack->size), POISON, count * sizeof(StackElem_t));
+
+    #ifdef HASH_PROTECTION
+
+    for (size_t i = 0; i < count; i++)
+    {
+        stack->DataHash -= DataElemHash(values[i], stack->size + i);
+    }
+
+    #endif
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    uint64_t NewCapacity = ShrinkCapacity(stack);
+
+    if (NewCapacity != stack->capacity && StackResize(StackId, NewCapacity) == FAILED)
+    {
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    stack = GetStack(StackId);
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+    STACK_ASSERT(STACK_IS_VALID(    StackId));
+
+    STACK_ASSERT(STACK_CHECK_AFTER( StackId));
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+    return EXECUTED;
+}
+
+StackReturnCode StackResize(StackId_t StackId, size_t NewCapacity)
+{
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(StackId));
+
+    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+
+    if (NewCapacity < MIN_STACK_SIZE)
+    {
+        StackRaise(StackId, REQUESTED_TOO_LITTLE);
+
+        return FAILED;
+    }
+
+    if (NewCapacity > MaxCapacity(stack))
+    {
+        StackRaise(StackId, REQUESTED_TOO_MUCH);
+
+        return FAILED;
+    }
+
+    if (NewCapacity < stack->size)
+    {
+        StackRaise(StackId, INVALID_SIZE);
+
+        return FAILED;
+    }
+
+    uint64_t OldCapacity = stack->capacity;
+
+    StackStats_t* stats = &(RegistryGet(StackId)->stats);
+
+    StatAdd(NewCapacity > OldCapacity ? &(stats->grows) : &(stats->shrinks), 1);
+
+    StatAdd(&(stats->BytesMoved), stack->size * sizeof(StackElem_t));
+
+    #if defined(DEBUG) || defined(CANARY_PROTECTION)
+
+    uint64_t NewMemorySize = ALIGNED_TO(sizeof(uint64_t), sizeof(Stack_t)) + \
+                             ALIGNED_TO(sizeof(uint64_t), sizeof(Canary_t) + \
+                             NewCapacity * sizeof(StackElem_t)) + sizeof(Canary_t);
+
+    stack = StackRealloc(stack, NewMemorySize);
+
+    if (!(stack))
+    {
+        StackRaise(StackId, INVALID_STACK_POINTER);
+
+        return FAILED;
+    }
+
+    stack->DataLeftCanary = (Canary_t*) (stack + 1);
+
+    stack->data = (StackElem_t*)((char*) stack->DataLeftCanary + sizeof(Canary_t));
+
+    if (NewMemorySize > stack->MemorySize)
+    {
+        *((Canary_t*)((char*) stack + stack->MemorySize - sizeof(Canary_t))) = 0; // null previous r_canary
+    }
+
+    stack->MemorySize = NewMemorySize;
+
+    stack->capacity   = NewCapacity;
+
+    stack->DataRightCanary = (Canary_t*) ((char*) stack + NewMemorySize - sizeof(Canary_t));
+
+    *(stack->DataRightCanary) = CANARY;
+
+    #else
+
+    uint64_t NewMemorySize = sizeof(Stack_t) + NewCapacity * sizeof(StackElem_t);
+
+    stack = StackRealloc(stack, NewMemorySize);
+
+    if (!(stack))
+    {
+        StackRaise(StackId, INVALID_STACK_POINTER);
+
+        return FAILED;
+    }
+
+    stack->data = (StackElem_t*) (stack + 1);
+
+    stack->MemorySize = NewMemorySize;
+
+    stack->capacity = NewCapacity;
+
+    #endif
+
+    if (stack->LazyPoison)
+    {
+        stack->touched = stack->touched < NewCapacity ? stack->touched : NewCapacity;
+    }
+    else
+    {
+        if (NewCapacity > OldCapacity)
+        {
+            memset((void*) (stack->data + OldCapacity), POISON, (NewCapacity - OldCapacity) * sizeof(StackElem_t));
+        }
+
+        stack->touched = NewCapacity;
+    }
+
+    ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__)); // prints up to touched, so not before it is clamped
+
+    __atomic_store_n(&RegistryGet(StackId)->stack, stack, __ATOMIC_RELEASE);
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    STACK_ASSERT(STACK_IS_VALID(  StackId));
+
+    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+
+    return EXECUTED;
+}
+
+StackReturnCode StackReserve(StackId_t StackId, size_t capacity)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    if (slot->mode != STACK_MODE_LOCKED)
+    {
+        return FAILED;
+    }
+
+    if (slot->frozen)
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(  StackId));
+
+    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+
+    if (capacity > MaxCapacity(stack))
+    {
+        StackRaise(StackId, REQUESTED_TOO_MUCH);
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    if (stack->segments) // chunks are linked on demand, nothing to reserve
+    {
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return EXECUTED;
+    }
+
+    stack->reserved = capacity;
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    if (capacity > stack->capacity && StackResize(StackId, capacity) == FAILED)
+    {
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+    return EXECUTED;
+}
+
+// Drops the StackReserve floor and shrinks to the live size, ignoring the policy.
+
+StackReturnCode StackShrinkToFit(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    if (slot->mode != STACK_MODE_LOCKED)
+    {
+        return FAILED;
+    }
+
+    if (slot->frozen)
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(  StackId));
+
+    STACK_ASSERT(STACK_IS_DAMAGED(StackId));
+
+    if (stack->segments)
+    {
+        SegmentedShrink(stack->segments);
+
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return EXECUTED;
+    }
+
+    stack->reserved = 0;
+
+    ON_HASH_PROTECTION(CountStructHash(StackId));
+
+    uint64_t NewCapacity = stack->size < MIN_STACK_SIZE ? MIN_STACK_SIZE : stack->size;
+
+    if (NewCapacity != stack->capacity && StackResize(StackId, NewCapacity) == FAILED)
+    {
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
+
+    return EXECUTED;
+}
+
+StackReturnCode StackGetCheckCounters(StackId_t StackId, StackCheckCounters_t* counters)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot || !counters)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    *counters = slot->check.counters;
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+    return EXECUTED;
+}
+
+StackReturnCode StackGetResizeCounters(StackId_t StackId, StackResizeCounters_t* counters)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot || !counters)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    counters->grows      = __atomic_load_n(&(slot->stats.grows),      __ATOMIC_RELAXED);
+
+    counters->shrinks    = __atomic_load_n(&(slot->stats.shrinks),    __ATOMIC_RELAXED);
+
+    counters->BytesMoved = __atomic_load_n(&(slot->stats.BytesMoved), __ATOMIC_RELAXED);
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+    return EXECUTED;
+}
+
+uint64_t StackGetErr()
+{
+    return err;
+}
+
+uint64_t StackClearErr()
+{
+    uint64_t codes = err;
+
+    err = NO_ERROR;
+
+    return codes;
+}
+
+uint64_t StackGetStackErr(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return INVALID_STACK_ID_ERR;
+    }
+
+    return __atomic_load_n(&(slot->errors), __ATOMIC_RELAXED);
+}
+
+uint64_t StackClearStackErr(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return INVALID_STACK_ID_ERR;
+    }
+
+    return __atomic_exchange_n(&(slot->errors), NO_ERROR, __ATOMIC_RELAXED);
+}
+
+StackReturnCode StackGetStats(StackId_t StackId, StackStats_t* stats)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot || !stats)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    memset(stats, 0, sizeof(StackStats_t));
+
+    StatsAccumulate(stats, &(slot->stats));
+
+    return EXECUTED;
+}
+
+// Live stacks plus everything the destroyed ones did, so the totals never go
+// back. A stack destroyed during the walk may be counted twice or not at all.
+
+StackReturnCode StackGetTotalStats(StackStats_t* stats)
+{
+    if (!stats)
+    {
+        err |= INVALID_DATA_POINTER;
+
+        return FAILED;
+    }
+
+    memset(stats, 0, sizeof(StackStats_t));
+
+    StatsAccumulate(stats, &RetiredStats);
+
+    for (StackId_t id = RegistryNext(INVALID_STACK_ID); id != INVALID_STACK_ID; id = RegistryNext(id))
+    {
+        StackSlot_t* slot = RegistryGet(id);
+
+        if (slot)
+        {
+            StatsAccumulate(stats, &(slot->stats));
+        }
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode StackDumpStats(FILE* file)
+{
+    if (!file)
+    {
+        err |= INVALID_FILE_POINTER;
+
+        return FAILED;
+    }
+
+    StackStats_t stats = {};
+
+    ON_HTML(fprintf(file, "<pre>\n"));
+
+    fprintf(file, "%-24s %10s %10s %10s %8s %8s %12s %10s %10s %12s\n", "stack", "pushes", "pops", "underflows",
+                  "grows", "shrinks", "bytes moved", "peak size", "lock waits", "lock wait ns");
+
+    for (StackId_t id = RegistryNext(INVALID_STACK_ID); id != INVALID_STACK_ID; id = RegistryNext(id))
+    {
+        char name[32] = "";
+
+        snprintf(name, sizeof(name), "%ld", id);
+
+        ON_DEBUG(Stack_t* stack = GetStack(id));
+
+        ON_DEBUG(snprintf(name, sizeof(name), "%s", stack && stack->name ? stack->name : "?"));
+
+        StackSlot_t* slot = RegistryGet(id);
+
+        if (!slot)
+        {
+            continue; // destroyed meanwhile
+        }
+
+        memset(&stats, 0, sizeof(StackStats_t));
+
+        StatsAccumulate(&stats, &(slot->stats));
+
+        StatsPrint(file, name, &stats);
+    }
+
+    StackGetTotalStats(&stats);
+
+    StatsPrint(file, "total", &stats);
+
+    ON_HTML(fprintf(file, "</pre>\n"));
+
+    return EXECUTED;
+}
+
+void StatsPrint(FILE* file, const char* name, const StackStats_t* stats)
+{
+    fprintf(file, "%-24s %10lu %10lu %10lu %8lu %8lu %12lu %10lu %10lu %12lu\n", name, stats->pushes, stats->pops,
+                  stats->underflows, stats->grows, stats->shrinks, stats->BytesMoved, stats->PeakSize,
+                  stats->LockWaits, stats->LockWaitNs);
+}
+
+uint64_t GrowCapacity(const Stack_t* stack, uint64_t needed)
+{
+    uint64_t capacity = stack->capacity;
+
+    while (capacity < needed)
+    {
+        uint64_t grown = (uint64_t) ((double) capacity * stack->policy.GrowthFactor);
+
+        capacity = grown > capacity ? grown : capacity + 1;
+    }
+
+    return capacity > MaxCapacity(stack) ? MaxCapacity(stack) : capacity;
+}
+
+uint64_t ShrinkCapacity(const Stack_t* stack)
+{
+    if (stack->policy.NeverShrink)
+    {
+        return stack->capacity;
+    }
+
+    uint64_t floor    = stack->policy.MinCapacity > stack->reserved ? stack->policy.MinCapacity : stack->reserved;
+
+    uint64_t capacity = stack->capacity;
+
+    while ((double) stack->size <= (double) capacity * stack->policy.ShrinkLoad)
+    {
+        uint64_t shrunk = (uint64_t) ((double) capacity / stack->policy.GrowthFactor);
+
+        if (shrunk < floor)
+        {
+            shrunk = floor;
+        }
+
+        if (shrunk >= capacity || shrunk <= stack->size)
+        {
+            break;
+        }
+
+        capacity = shrunk;
+    }
+
+    return capacity;
+}
+
+uint64_t MaxCapacity(const Stack_t* stack)
+{
+    return IsMapped(stack->storage) ? MAX_MAPPED_STACK_SIZE : MAX_STACK_SIZE;
+}
+
+bool IsMapped(StackStorage storage)
+{
+    return storage == STACK_STORAGE_MAPPED || storage == STACK_STORAGE_FILE;
+}
+
+// Everything a stack file depends on besides its own header: the size of Stack_t
+// and of an element, and the protections that change the block layout.
+
+uint64_t FileLayout()
+{
+    uint64_t config = 0;
+
+    ON_DEBUG(            config |= 1);
+
+    ON_CANARY_PROTECTION(config |= 2);
+
+    ON_HASH_PROTECTION(  config |= 4);
+
+    return (uint64_t) sizeof(Stack_t) | (uint64_t) sizeof(StackElem_t) << 16 | config << 32;
+}
+
+Stack_t* StackAlloc(const StackOptions_t* options, uint64_t MemorySize)
+{
+    uint64_t ReserveSize = MemorySize + ((uint64_t) MAX_MAPPED_STACK_SIZE + 1) * sizeof(StackElem_t);
+
+    if (options->storage == STACK_STORAGE_MAPPED)
+    {
+        return (Stack_t*) mapped_alloc(ReserveSize, MemorySize);
+    }
+
+    if (options->storage == STACK_STORAGE_FILE)
+    {
+        Stack_t* stack = (Stack_t*) file_alloc(options->path, FileLayout(), ReserveSize, MemorySize);
+
+        if (!stack) // locked by another stack, or not empty
+        {
+            err |= INVALID_FILE_POINTER;
+        }
+
+        return stack;
+    }
+
+    #if   defined(GUARD_PROTECTION)
+
+    return (Stack_t*) guarded_alloc(MemorySize);
+
+    #elif defined(DEBUG) || defined(CANARY_PROTECTION)
+
+    if (options->LazyPoison) // the ctor initializes everything but the free slots
+    {
+        return (Stack_t*) log_malloc(MemoryLogFile, MemorySize);
+    }
+
+    return (Stack_t*) log_calloc(MemoryLogFile, 1, MemorySize);
+
+    #else
+
+    if (options->LazyPoison)
+    {
+        return (Stack_t*) pool_malloc(MemorySize);
+    }
+
+    return (Stack_t*) pool_calloc(1, MemorySize);
+
+    #endif
+}
+
+Stack_t* StackRealloc(Stack_t* stack, uint64_t MemorySize)
+{
+    if (stack->storage == STACK_STORAGE_MAPPED)
+    {
+        return (Stack_t*) mapped_realloc(stack, MemorySize);
+    }
+
+    if (stack->storage == STACK_STORAGE_FILE)
+    {
+        return (Stack_t*) file_realloc(stack, MemorySize);
+    }
+
+    #if   defined(GUARD_PROTECTION)
+
+    return (Stack_t*) guarded_realloc(stack, MemorySize);
+
+    #elif defined(DEBUG) || defined(CANARY_PROTECTION)
+
+    return (Stack_t*) log_realloc(MemoryLogFile, stack, MemorySize);
+
+    #else
+
+    return (Stack_t*) pool_realloc(stack, MemorySize);
+
+    #endif
+}
+
+void StackFree(Stack_t* stack)
+{
+    if (stack->storage == STACK_STORAGE_MAPPED)
+    {
+        mapped_free(stack);
+
+        return;
+    }
+
+    if (stack->storage == STACK_STORAGE_FILE)
+    {
+        file_free(stack);
+
+        return;
+    }
+
+    #if   defined(GUARD_PROTECTION)
+
+    guarded_free(stack);
+
+    #elif defined(DEBUG) || defined(CANARY_PROTECTION)
+
+    log_free(MemoryLogFile, stack);
+
+    #else
+
+    pool_free(stack);
+
+    #endif
+}
+
+#ifdef GUARD_PROTECTION
+
+// Out-of-bounds writes into a guard page end up here. The handler looks up the
+// stack whose guard was hit, reports it and puts the previous action back, so
+// the faulting write runs again and crashes (or reaches the caller's handler)
+// as it would have without us. Only the report is new, nothing is recovered.
+// Faults that hit no guard are passed to the previous handler and leave ours
+// installed; a default or ignored action is put back, as the fault is fatal.
+
+void GuardInstall()
+{
+    struct sigaction action = {};
+
+    action.sa_sigaction = GuardHandler;
+
+    action.sa_flags     = SA_SIGINFO;
+
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, &GuardPrevAction);
+}
+
+void GuardHandler(int signal, siginfo_t* info, void* context)
+{
+    StackSlot_t* slot = RegistryFind(GuardMatch, info->si_addr);
+
+    if (!slot)
+    {
+        if (GuardPrevAction.sa_flags & SA_SIGINFO)
+        {
+            GuardPrevAction.sa_sigaction(signal, info, context);
+        }
+        else if (GuardPrevAction.sa_handler != SIG_DFL && GuardPrevAction.sa_handler != SIG_IGN)
+        {
+            GuardPrevAction.sa_handler(signal);
+        }
+        else
+        {
+            sigaction(SIGSEGV, &GuardPrevAction, nullptr);
+        }
+
+        return;
+    }
+
+    Stack_t* stack = __atomic_load_n(&slot->stack, __ATOMIC_ACQUIRE);
+
+    char report[GUARD_REPORT_SIZE] = "";
 
-        err += INVALID_FILE_POINTER;
+    size_t length = 0;
 
-        return FAILED;
+    length = GuardAppend      (report, length, "Stack[0x");
+    length = GuardAppendNumber(report, length, (uintptr_t) stack, 16);
+    length = GuardAppend      (report, length, "] guard page hit at 0x");
+    length = GuardAppendNumber(report, length, (uintptr_t) info->si_addr, 16);
+    length = GuardAppend      (report, length, guarded_hit(stack, info->si_addr) > 0 ? ", past" : ", before");
+    length = GuardAppend      (report, length, " the elements\n    id = ");
+    length = GuardAppendNumber(report, length, (uint64_t) stack->id, 10);
+    length = GuardAppend      (report, length, "\n");
+
+    #ifdef DEBUG
+
+    length = GuardAppend      (report, length, "    \"");
+    length = GuardAppend      (report, length, stack->name);
+    length = GuardAppend      (report, length, "\" born at ");
+    length = GuardAppend      (report, length, stack->BornFile);
+    length = GuardAppend      (report, length, ":");
+    length = GuardAppendNumber(report, length, (uint64_t) stack->BornLine, 10);
+    length = GuardAppend      (report, length, " (");
+    length = GuardAppend      (report, length, stack->BornFunc);
+    length = GuardAppend      (report, length, ")\n");
+
+    #endif
+
+    write(STDERR_FILENO, report, length);
+
+    sigaction(SIGSEGV, &GuardPrevAction, nullptr);
+}
+
+bool GuardMatch(const StackSlot_t* slot, const void* address)
+{
+    const Stack_t* stack = __atomic_load_n(&slot->stack, __ATOMIC_ACQUIRE);
+
+    return !IsMapped(stack->storage) && guarded_hit(stack, address) != 0;
+}
+
+// snprintf is not async-signal-safe, so the report is put together by hand. Both
+// helpers stop at the end of the buffer (keeping the last byte free) and return
+// the new length.
+
+size_t GuardAppend(char* report, size_t length, const char* text)
+{
+    for (; text && *text && length < GUARD_REPORT_SIZE - 1; text++)
+    {
+        report[length++] = *text;
     }
 
-    time_t RawTime;
+    return length;
+}
 
-    struct tm* TimeInfo;
+size_t GuardAppendNumber(char* report, size_t length, uint64_t value, unsigned base)
+{
+    char digits[24] = "";
 
-    time(&RawTime);
+    size_t count = 0;
 
-    TimeInfo = localtime(&RawTime);
+    do
+    {
+        digits[count++] = "0123456789abcdef"[value % base];
 
-    ON_HTML(fprintf(DumpFile, "<p style=\"color:LightGrey;\">"
-                              "Local time and date: </p><p style=\"color:LightBlue;\">%s<bp>"
-                              "</p>", asctime(TimeInfo)));
+        value /= base;
+    }
+    while (value);
 
-    ON_LOG( fprintf(DumpFile, "Local time and date: %s\n", asctime(TimeInfo)));
+    char text[24] = "";
 
-    PrintErr(DumpFile, err);
+    for (size_t i = 0; i < count; i++)
+    {
+        text[i] = digits[count - 1 - i];
+    }
 
-    if (!stack)
+    return GuardAppend(report, length, text);
+}
+
+#endif
+
+StackReturnCode StackDtor(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot || !__atomic_load_n(&slot->stack, __ATOMIC_ACQUIRE))
+    {
+        return FAILED;
+    }
+
+    if (slot->check.pending && STACK_VERIFY(StackId) == STACK_DAMAGED)
     {
-        ON_HTML(fprintf(DumpFile, "<p style=\"color:Red\">"
-                                  "Lost stack pointer</br>"
-                                  "</p>"));
+        return FAILED; // StackVerify has already destroyed it
+    }
 
-        ON_LOG( fprintf(DumpFile, "Lost stack pointer\n"));
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
 
-        fclose(DumpFile);
+    Stack_t* stack = GetStack(StackId);
 
-        return EXECUTED;
+    if (stack->mode == STACK_MODE_LOCK_FREE)
+    {
+        LockFreeDtor(stack->LockFree);
     }
 
-    ON_LOG(fprintf(DumpFile,  "Stack_t[%p] %s at %s:%d in function %s\nBorn at %s:%d in function %s\n\n"
-                              "Stack ID             = %d\n\n"
-                              "LEFT  STRUCT CANARY  = %lu\n"
-                              "RIGHT STRUCT CANARY  = %lu\n\n"
-                              "LEFT  DATA   CANARY  = %lu\n"
-                              "RIGHT DATA   CANARY  = %lu\n\n"
-                              "STRUCT HASH          = %lu\n"
-                              "DATA   HASH          = %lu\n\n"
-                              "capacity             = %lu\n"
-                              "size                 = %lu\n\n",
-                              stack, stack->name, file, line, function, stack->BornFile, stack->BornLine, stack->BornFunc,
-                              stack->id,
-                              stack->left_canary,
-                              stack->right_canary,
-                              *(stack->DataLeftCanary),
-                              *(stack->DataRightCanary),
-                              stack->StructHash,
-                              stack->DataHash,
-                              stack->capacity,
-                              stack->size));
-
-    ON_HTML(fprintf(DumpFile, "<h3>Stack_t[<em style=\"color:Red;\">%p</em>] %s"
-                              " at <em style=\"color:Red;\">%s</em>:"
-                              "<em style=\"color:Red;\">%d</em> in function"
-                              " <em style=\"color:Red;\">%s</em><br>Born"
-                              " at <em style=\"color:Red;\">%s</em>:"
-                              "<em style=\"color:Red;\">%d</em> in function "
-                              "<em style=\"color:Red;\">%s</em></h1><br>"
-                              "Stack ID              = <em style=\"color:Red;\">%d</em><br><br>"
-                              "LEFT   STRUCT CANARY  = <em style=\"color:Red;\">%lu</em><br>"
-                              "RIGHT  STRUCT CANARY  = <em style=\"color:Red;\">%lu</em><br><br>"
-                              "LEFT   DATA   CANARY  = <em style=\"color:Red;\">%lu</em><br>"
-                              "RIGHT  DATA   CANARY  = <em style=\"color:Red;\">%lu</em><br><br>"
-                              "STRUCT HASH           = <em style=\"color:Red;\">%lu</em><br>"
-                              "DATA   HASH           = <em style=\"color:Red;\">%lu</em><br><br>"
-                              "capacity              = <em style=\"color:Red;\">%lu</em><br>"
-                              "size                  = <em style=\"color:Red;\">%lu</em><br><br>"
-                              "</em>",
-                              stack, stack->name, file, line, function, stack->BornFile, stack->BornLine, stack->BornFunc,
-                              stack->id,
-                              stack->left_canary,
-                              stack->right_canary,
-                              *(stack->DataLeftCanary),
-                              *(stack->DataRightCanary),
-                              stack->StructHash,
-                              stack->DataHash,
-                              stack->capacity,
-                              stack->size));
+    if (stack->elimination)
+    {
+        EliminationDtor(stack->elimination);
+    }
 
-    if (!stack->data)
+    if (stack->mode == STACK_MODE_WORK_STEALING)
     {
-        ON_HTML(fprintf(DumpFile, "<p style=\"color:LightRed\">"
-                                  "Lost stack->data pointer<br>"
-                                  "<br><br>---------------------------------------------------------------------<br><br></p>"));
+        WorkStealDtor(stack->deque);
+    }
 
-        ON_LOG(fprintf(DumpFile,  "Lost stack->data pointer\n"
-                                  "\n\n---------------------------------------------------------------------\n\n"));
+    if (stack->segments)
+    {
+        SegmentedDtor(stack->segments);
+    }
 
-        return EXECUTED;
+    if (!IsMapped(stack->storage)) // unmapped pages need no scrubbing, a file keeps its stack
+    {
+        memset(stack, 0, stack->MemorySize);
     }
 
-    for (int i = 0; i < stack->capacity; i++)
+    StackFree(stack);
+
+    stack = nullptr;
+
+    StatsAccumulate(&RetiredStats, &(slot->stats));
+
+    RegistryRelease(StackId);
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+    if (__atomic_sub_fetch(&STACK_AMOUNT, 1, __ATOMIC_ACQ_REL) == 0)
     {
-        if (i < stack->size)
+        #ifdef DEBUG
+
+        pthread_mutex_lock(&LogFilesMutex);
+
+        if (MemoryLogFile)
         {
-            ON_HTML(fprintf(DumpFile, "<em style=\"color:LightGrey;\">"
-                                      "[%d] = </em><em style=\"color:LightBlue;\">%ld</em><br>", i, stack->data[i]));
+            alloc_trace_report(MemoryLogFile);
+
+            ON_HTML(fprintf(MemoryLogFile, "</html>\n"));
+
+            fclose(MemoryLogFile);
 
-            ON_LOG( fprintf(DumpFile, "[%d] = %ld\n", i, stack->data[i]));
+            MemoryLogFile = nullptr;
         }
-        else
+
+        if (DumpFile)
+        {
+            #ifdef ASYNC_DUMP
+
+            DumpAsyncStop();
+
+            #endif
+
+            #ifndef BINARY_DUMP
+
+            ON_HTML(fprintf(DumpFile, "</html>\n"));
+
+            #endif
+
+            fclose(DumpFile);
+
+            DumpFile = nullptr;
+        }
+
+        pthread_mutex_unlock(&LogFilesMutex);
+
+        #endif
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode StackSteal(StackId_t StackId, StackElem_t* value)
+{
+    Stack_t* stack = GetStack(StackId);
+
+    if (!stack || stack->mode != STACK_MODE_WORK_STEALING)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return FAILED;
+    }
+
+    return WorkStealSteal(stack->deque, value);
+}
+
+StackReturnCode StackGroupCtor(StackId_t* ids, int count, int capacity, int line, const char* file, const char* function)
+{
+    StackOptions_t options = {STACK_MODE_WORK_STEALING, false};
+
+    for (int i = 0; i < count; i++)
+    {
+        ids[i] = StackCtorEx(capacity, &options, line, file, function);
+
+        if (ids[i] == INVALID_STACK_ID)
         {
-            ON_HTML(fprintf(DumpFile, "<em style=\"color:LightGrey;\">"
-                                      "[%d] = </em><em style=\"color:LightBlue;\">%ld (POISON)</em><br>", i, stack->data[i]));
+            StackGroupDtor(ids, i);
 
-            ON_LOG( fprintf(DumpFile, "[%d] = %ld (POISON) \n", i, stack->data[i]));
+            return FAILED;
         }
     }
 
-    ON_HTML(fprintf(DumpFile, "<p><br><br>---------------------------------------------------------------------<br><br></p>"));
+    return EXECUTED;
+}
+
+StackReturnCode StackGroupSteal(const StackId_t* ids, int count, int thief, StackElem_t* value)
+{
+    for (int i = 1; i < count; i++)
+    {
+        if (StackSteal(ids[(thief + i) % count], value) == EXECUTED)
+        {
+            return EXECUTED;
+        }
+    }
 
-    ON_LOG( fprintf(DumpFile, "\n\n---------------------------------------------------------------------\n\n"));
+    return FAILED;
+}
 
-    #endif
+StackReturnCode StackGroupDtor(StackId_t* ids, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        StackDtor(ids[i]);
+    }
 
     return EXECUTED;
 }
 
-StackReturnCode CountDataHash(StackId_t StackId)
+StackReturnCode StackDump(Stack_t* stack ON_DEBUG(, int line, const char* file, const char* function))
 {
     #ifdef DEBUG
 
-    Stack_t* stack = STACKS[StackId - 1];
+    if (!DumpFile)
+    {
+        fprintf(stderr, "INVALID FILE POINTER\n");
+
+        err |= INVALID_FILE_POINTER;
 
-    STACK_ASSERT(STACK_IS_VALID(StackId));
+        return FAILED;
+    }
+
+    DumpRecord_t record = {};
+
+    record.timestamp = DumpNow();
+
+    record.err       = err;
+
+    record.address   = stack;
+
+    record.file      = file;
+
+    record.line      = line;
+
+    record.function  = function;
+
+    record.LostStack = !stack;
+
+    if (stack)
+    {
+        record.name            = stack->name;
+        record.BornFile        = stack->BornFile;
+        record.BornLine        = stack->BornLine;
+        record.BornFunc        = stack->BornFunc;
+        record.id              = stack->id;
+        record.LeftCanary      = stack->left_canary;
+        record.RightCanary     = stack->right_canary;
+        record.DataLeftCanary  = *(stack->DataLeftCanary);
+        record.DataRightCanary = *(stack->DataRightCanary);
+        record.StructHash      = stack->StructHash;
+        record.DataHash        = stack->DataHash;
+        record.capacity        = stack->capacity;
+        record.size            = stack->size;
+        record.touched         = stack->touched;
+        record.LostData        = !stack->data;
+    }
 
-    uint64_t DataHash = 5831;
+    if (stack && stack->segments) // size and capacity of Stack_t are placeholders, elements are not captured
+    {
+        record.size            = SegmentedSize(stack->segments);
+        record.capacity        = SegmentedCapacity(stack->segments);
+        record.touched         = record.capacity;
+        record.ElemsFirst      = record.size;
+    }
 
-    for (size_t i = 0; i < stack->capacity; i++)
+    #ifdef ASYNC_DUMP
+
+    if (stack && stack->data && !stack->segments && stack->size <= stack->capacity)
     {
-        DataHash = 33 * DataHash + stack->data[i];
+        record.ElemsCount = stack->size < DUMP_RECORD_ELEMS ? stack->size : DUMP_RECORD_ELEMS;
+
+        record.ElemsFirst = stack->size - record.ElemsCount;
+
+        memcpy(record.elems, stack->data + record.ElemsFirst, record.ElemsCount * sizeof(StackElem_t));
     }
 
-    stack->DataHash = DataHash;
+    return DumpAsyncPush(&record);
+
+    #else
+
+    return DumpEmit(DumpFile, &record, stack && !stack->segments ? stack->data : nullptr);
+
+    #endif
+
+    #endif
+
+    return EXECUTED;
+}
+
+// DataHash is a sum of position-mixed element hashes over the live prefix [0, size),
+// so StackPush/StackPop keep it up to date in O(1) and only StackVerify walks the data.
+
+StackReturnCode CountDataHash(StackId_t StackId)
+{
+    #ifdef HASH_PROTECTION
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(StackId));
+
+    stack->DataHash = DataHashOf(stack->data, stack->size);
 
     #endif
 
@@ -596,82 +2266,262 @@ StackReturnCode CountDataHash(StackId_t StackId)
 
 StackReturnCode CountStructHash(StackId_t StackId)
 {
-    #ifdef HASH_PROTECTION
+    #ifdef HASH_PROTECTION
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(StackId));
+
+    stack->StructHash = StructHashOf(stack);
+
+    #endif
+
+    return EXECUTED;
+}
+
+#ifdef HASH_PROTECTION
+
+uint64_t DataHashOf(const StackElem_t* data, uint64_t size)
+{
+    return 5831 + DataBlockHash(data, size, 0);
+}
+
+uint64_t StructHashOf(const Stack_t* stack)
+{
+    const size_t AFTER_HASH = STRUCT_HASH_OFFSET + sizeof(stack->StructHash);
+
+    uint64_t StructHash = StructBlockHash(5831, stack, STRUCT_HASH_OFFSET);
+
+    StructHash = StructBlockHash(StructHash, (const char*) stack + AFTER_HASH, sizeof(Stack_t) - AFTER_HASH);
+
+    return StructHash;
+}
+
+#endif
+
+// Checks one stack off its hot path. The slot lock is held only to copy the struct
+// and the data canaries, which are then checked on the copy, and to hash one
+// SCRUB_CHUNK of the live elements at a time (ScrubDataHash), so a large stack
+// never holds its lock for O(size). Damage is reported and the stack is switched
+// to checking every operation, so its next push/pop fails through the usual
+// StackIsDamaged path. A data hash that could not be finished because the stack
+// kept changing returns FAILED and leaves the check pending for StackVerify.
+// Lock-free and work-stealing stacks keep their elements outside Stack_t and are
+// skipped.
+
+StackReturnCode StackScrub(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return FAILED;
+    }
+
+    pthread_mutex_lock(&(slot->mutex));
+
+    Stack_t* stack = GetStack(StackId);
+
+    if (!stack || stack->mode != STACK_MODE_LOCKED)
+    {
+        pthread_mutex_unlock(&(slot->mutex));
+
+        return stack ? STACK_NOT_DAMAGED : FAILED;
+    }
+
+    if (slot->check.damaged)
+    {
+        pthread_mutex_unlock(&(slot->mutex));
+
+        return STACK_DAMAGED;
+    }
+
+    Stack_t snapshot = {};
+
+    memcpy((void*) &snapshot, stack, sizeof(Stack_t)); // padding included, StructHash covers it
+
+    uint64_t code = NO_ERROR;
+
+    ON_CANARY_PROTECTION(Canary_t DataCanaries[2] = {*(stack->DataLeftCanary), *(stack->DataRightCanary)});
+
+    ON_HASH_PROTECTION(bool HashData = false);
+
+    if (!snapshot.data || snapshot.size > snapshot.capacity)
+    {
+        code |= snapshot.data ? INVALID_SIZE : INVALID_DATA_POINTER;
+    }
+    else if (snapshot.segments)
+    {
+        if (SegmentedVerify(snapshot.segments) == FAILED)
+        {
+            code |= DAMAGED_STACK_ERR;
+        }
+    }
+    else
+    {
+        ON_HASH_PROTECTION(HashData = true);
+    }
+
+    pthread_mutex_unlock(&(slot->mutex));
+
+    #ifdef CANARY_PROTECTION
+
+    if (snapshot.left_canary != CANARY || snapshot.right_canary != CANARY)
+    {
+        code |= INVALID_STRUCT_CANARY;
+    }
+
+    if (DataCanaries[0] != CANARY || DataCanaries[1] != CANARY)
+    {
+        code |= INVALID_DATA_CANARY;
+    }
+
+    #endif
+
+    StackReturnCode DataCode = STACK_NOT_DAMAGED;
+
+    #ifdef HASH_PROTECTION
+
+    if (StructHashOf(&snapshot) != snapshot.StructHash)
+    {
+        code |= INVALID_HASH;
+    }
+    else if (code == NO_ERROR && HashData)
+    {
+        DataCode = ScrubDataHash(StackId, slot);
+
+        if (DataCode == STACK_DAMAGED)
+        {
+            code |= INVALID_HASH;
+        }
+    }
+
+    #endif
+
+    if (code == NO_ERROR)
+    {
+        if (DataCode == FAILED)
+        {
+            pthread_mutex_lock(&(slot->mutex));
+
+            slot->check.pending = true;
+
+            pthread_mutex_unlock(&(slot->mutex));
+        }
+
+        return DataCode;
+    }
+
+    StackRaise(StackId, code);
+
+    fprintf(stderr, "Scrubber: stack %ld is damaged. ", StackId);
+
+    PrintErr(stderr, code);
+
+    pthread_mutex_lock(&(slot->mutex));
+
+    if (GetStack(StackId))
+    {
+        ON_DEBUG(StackDump(GetStack(StackId), __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+        slot->check.policy.mode = STACK_CHECK_ALWAYS;
+
+        slot->check.pending     = true;
+
+        slot->check.damaged     = true;
+    }
+
+    pthread_mutex_unlock(&(slot->mutex));
+
+    return STACK_DAMAGED;
+}
+
+#ifdef HASH_PROTECTION
+
+// Recounts DataHash one SCRUB_CHUNK per lock hold. Every push/pop adds to the
+// slot's pushes or pops, so an unchanged sum between two chunks means the live
+// elements did not change (a resize may have moved them, so data is re-read
+// each time). Otherwise the recount starts over, at most SCRUB_RETRIES times,
+// then gives up with FAILED.
+
+StackReturnCode ScrubDataHash(StackId_t StackId, StackSlot_t* slot)
+{
+    for (int attempt = 0; attempt < SCRUB_RETRIES; attempt++)
+    {
+        uint64_t ops      = 0;
 
-    Stack_t* stack = STACKS[StackId - 1];
+        uint64_t size     = 0;
 
-    STACK_ASSERT(STACK_IS_VALID(StackId));
+        uint64_t expected = 0;
 
-    #ifdef THREAD_PROTECTION
+        uint64_t hash     = 5831;
 
-    uint64_t FirstOffset, FirstSize, SecondOffset, SecondSize = 0;
+        uint64_t done     = 0;
 
-    if (STRUCT_HASH_OFFSET < MUTEX_OFFSET)
-    {
-        FirstOffset  = STRUCT_HASH_OFFSET;
-        FirstSize    = sizeof(stack->StructHash);
-        SecondOffset = MUTEX_OFFSET;
-        SecondSize   = sizeof(stack->mutex);
-    }
-    else
-    {
-        FirstOffset  = MUTEX_OFFSET;
-        FirstSize    = sizeof(stack->mutex);
-        SecondOffset = STRUCT_HASH_OFFSET;
-        SecondSize   = sizeof(stack->StructHash);
-    }
+        bool     changed  = false;
 
-    uint64_t StructHash = 5831;
+        do
+        {
+            pthread_mutex_lock(&(slot->mutex));
 
-    for (size_t i = 0; i < FirstOffset; i++)
-    {
-        StructHash = 33 * StructHash + *((char*) stack + i);
-    }
+            Stack_t* stack = GetStack(StackId);
 
-    for (size_t i = FirstOffset + FirstSize; i < SecondOffset; i++)
-    {
-        StructHash = 33 * StructHash + *((char*) stack + i);
-    }
+            if (!stack || !stack->data || stack->segments || stack->size > stack->capacity)
+            {
+                pthread_mutex_unlock(&(slot->mutex));
 
-    for (size_t i = SecondOffset + SecondSize; i < sizeof(Stack_t); i++)
-    {
-        StructHash = 33 * StructHash + *((char*) stack + i);
-    }
+                return FAILED;
+            }
 
-    stack->StructHash = StructHash;
+            uint64_t now = __atomic_load_n(&(slot->stats.pushes), __ATOMIC_RELAXED) +
+                           __atomic_load_n(&(slot->stats.pops),   __ATOMIC_RELAXED);
 
-    #else
+            if (done == 0)
+            {
+                ops      = now;
 
-    uint64_t StructHash = 5831;
+                size     = stack->size;
 
-    for (size_t i = 0; i < STRUCT_HASH_OFFSET; i++)
-    {
-        StructHash = 33 * StructHash + *((char*) stack + i);
-    }
+                expected = stack->DataHash;
+            }
 
-    for (size_t i = STRUCT_HASH_OFFSET + sizeof(stack->StructHash); i < sizeof(Stack_t); i++)
-    {
-        StructHash = 33 * StructHash + *((char*) stack + i);
-    }
+            changed = now != ops || stack->size != size;
 
-    stack->StructHash = StructHash;
+            if (!changed)
+            {
+                uint64_t count = size - done < SCRUB_CHUNK ? size - done : SCRUB_CHUNK;
 
-    #endif
+                hash += DataBlockHash(stack->data + done, count, done);
 
-    #endif
+                done += count;
+            }
 
-    return EXECUTED;
+            pthread_mutex_unlock(&(slot->mutex));
+        }
+        while (!changed && done < size);
+
+        if (!changed)
+        {
+            return hash == expected ? STACK_NOT_DAMAGED : STACK_DAMAGED;
+        }
+    }
+
+    return FAILED;
 }
 
+#endif
+
 StackReturnCode StackIsValid(StackId_t StackId ON_DEBUG(, int line, const char* file, const char* function))
 {
-    Stack_t* stack = STACKS[StackId - 1];
+    Stack_t* stack = GetStack(StackId);
 
     ON_DEBUG(StackDump(stack, line, file, function));
 
     if (!stack)
     {
-        err += INVALID_STACK_POINTER;
+        err |= INVALID_STACK_POINTER;
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
@@ -682,11 +2532,11 @@ StackReturnCode StackIsValid(StackId_t StackId ON_DEBUG(, int line, const char*
 
     if (stack->id == INVALID_STACK_ID)
     {
-        err += INVALID_STACK_ID_ERR;
+        err |= INVALID_STACK_ID_ERR;
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
@@ -695,37 +2545,37 @@ StackReturnCode StackIsValid(StackId_t StackId ON_DEBUG(, int line, const char*
 
     if (!stack->data)
     {
-        err += INVALID_DATA_POINTER;
+        StackRaise(StackId, INVALID_DATA_POINTER);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_INVALID;
     }
 
-    if (stack->size > MAX_STACK_SIZE * sizeof(StackElem_t))
+    if (stack->size > MaxCapacity(stack))
     {
-        err += STACK_UNDERFLOW;
+        StackRaise(StackId, STACK_UNDERFLOW);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_INVALID;
     }
 
-    if (stack->size > stack->capacity)
+    if (stack->size > stack->capacity || stack->touched > stack->capacity)
     {
-        err += INVALID_SIZE;
+        StackRaise(StackId, INVALID_SIZE);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
@@ -747,6 +2597,8 @@ void StackAssert(StackReturnCode code, int line, const char* file, const char* f
 
         if (MemoryLogFile)
         {
+            alloc_trace_flush();
+
             fflush(MemoryLogFile);
 
             fclose(MemoryLogFile);
@@ -754,6 +2606,12 @@ void StackAssert(StackReturnCode code, int line, const char* file, const char* f
 
         if (DumpFile)
         {
+            #ifdef ASYNC_DUMP
+
+            DumpAsyncStop();
+
+            #endif
+
             fflush(DumpFile);
 
             fclose(DumpFile);
@@ -769,7 +2627,7 @@ StackReturnCode StackIsDamaged(StackId_t StackId, int line, const char* file, co
 {
     #if defined(DEBUG) || defined(HASH_PROTECTION) || defined(CANARY_PROTECTION)
 
-    Stack_t* stack = STACKS[StackId - 1];
+    Stack_t* stack = GetStack(StackId);
 
     STACK_ASSERT(STACK_IS_VALID(StackId));
 
@@ -779,11 +2637,11 @@ StackReturnCode StackIsDamaged(StackId_t StackId, int line, const char* file, co
 
     if (stack->left_canary != CANARY || stack->right_canary != CANARY)
     {
-        err += INVALID_STRUCT_CANARY;
+        StackRaise(StackId, INVALID_STRUCT_CANARY);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
@@ -792,75 +2650,79 @@ StackReturnCode StackIsDamaged(StackId_t StackId, int line, const char* file, co
 
     if (*(stack->DataLeftCanary) != CANARY || *(stack->DataRightCanary) != CANARY)
     {
-        err += INVALID_DATA_CANARY;
+        StackRaise(StackId, INVALID_DATA_CANARY);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_DAMAGED;
     }
 
-    uint64_t DataHash = stack->DataHash;
-
     uint64_t StructHash = stack->StructHash;
 
-    CountDataHash(StackId);
-
     CountStructHash(StackId);
 
     if (StructHash != stack->StructHash)
     {
-        err += INVALID_HASH;
+        StackRaise(StackId, INVALID_HASH);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_DAMAGED;
     }
 
-    if (DataHash != stack->DataHash)
+    #else
+
+    #ifdef CANARY_PROTECTION
+
+    if (stack->left_canary != CANARY || stack->right_canary != CANARY)
     {
-        err += INVALID_HASH;
+        StackRaise(StackId, INVALID_STRUCT_CANARY);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_DAMAGED;
     }
 
-    #else
-
-    #ifdef CANARY_PROTECTION
-
-    if (stack->left_canary != CANARY || stack->right_canary != CANARY)
+    if (*(stack->DataLeftCanary) != CANARY || *(stack->DataRightCanary) != CANARY)
     {
-        err += INVALID_STRUCT_CANARY;
+        StackRaise(StackId, INVALID_DATA_CANARY);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_DAMAGED;
     }
 
-    if (*(stack->DataLeftCanary) != CANARY || *(stack->DataRightCanary) != CANARY)
+    #endif
+
+    #ifdef HASH_PROTECTION
+
+    uint64_t StructHash = stack->StructHash;
+
+    CountStructHash(StackId);
+
+    if (StructHash != stack->StructHash)
     {
-        err += INVALID_DATA_CANARY;
+        StackRaise(StackId, INVALID_HASH);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
@@ -869,36 +2731,293 @@ StackReturnCode StackIsDamaged(StackId_t StackId, int line, const char* file, co
 
     #endif
 
-    #ifdef HASH_PROTECTION
+    ON_DEBUG(StackDump(stack, line, file, function));
 
-    uint64_t DataHash = stack->DataHash;
+    #endif
 
-    uint64_t StructHash = stack->StructHash;
+    #endif
 
-    CountDataHash(StackId);
+    return STACK_NOT_DAMAGED;
+}
 
-    CountStructHash(StackId);
+// STACK_CHECK_BEFORE decides whether this operation is checked, according to the
+// stack's StackCheckPolicy_t, and STACK_CHECK_AFTER follows the same decision.
 
-    if (StructHash != stack->StructHash)
+StackReturnCode StackCheckDamaged(StackId_t StackId, bool before, int line, const char* file, const char* function)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return STACK_INVALID;
+    }
+
+    StackCheckState_t* check = &(slot->check);
+
+    if (before)
+    {
+        check->due = StackCheckDue(check);
+
+        if (check->due)
+        {
+            check->counters.checked++;
+        }
+        else
+        {
+            check->counters.skipped++;
+
+            check->pending = true;
+        }
+    }
+
+    if (!check->due)
+    {
+        return STACK_NOT_DAMAGED;
+    }
+
+    if (check->policy.mode != STACK_CHECK_BUDGET)
+    {
+        return StackIsDamaged(StackId, line, file, function);
+    }
+
+    uint64_t start = CheckClock(CLOCK_MONOTONIC);
+
+    StackReturnCode code = StackIsDamaged(StackId, line, file, function);
+
+    check->WindowSpent += CheckClock(CLOCK_MONOTONIC) - start;
+
+    return code;
+}
+
+void StackCheckInit(StackCheckState_t* check, const StackCheckPolicy_t* policy, StackId_t StackId)
+{
+    *check = {};
+
+    check->policy = *policy;
+
+    check->random = ((uint64_t) StackId * 0x9E3779B97F4A7C15) | 1;
+
+    if (check->policy.mode == STACK_CHECK_EVERY_N && check->policy.period <= 1)
+    {
+        check->policy.mode = STACK_CHECK_ALWAYS;
+    }
+
+    if (check->policy.mode == STACK_CHECK_SAMPLED)
+    {
+        if (check->policy.probability >= 1)
+        {
+            check->policy.mode = STACK_CHECK_ALWAYS;
+        }
+        else if (check->policy.probability > 0)
+        {
+            check->threshold = (uint64_t) (check->policy.probability * 18446744073709551616.0);
+        }
+    }
+
+    check->WindowStart = CheckClock(CLOCK_MONOTONIC_COARSE);
+}
+
+bool StackCheckDue(StackCheckState_t* check)
+{
+    switch (check->policy.mode)
+    {
+        case STACK_CHECK_EVERY_N:
+            return ++check->tick % check->policy.period == 0;
+
+        case STACK_CHECK_SAMPLED:
+            check->random ^= check->random << 13;
+            check->random ^= check->random >> 7;
+            check->random ^= check->random << 17;
+
+            return check->random < check->threshold;
+
+        case STACK_CHECK_BUDGET:
+        {
+            uint64_t now = CheckClock(CLOCK_MONOTONIC_COARSE); // a few ns, unlike CLOCK_MONOTONIC
+
+            if (now - check->WindowStart >= 1000000000)
+            {
+                check->WindowStart = now;
+
+                check->WindowSpent = 0;
+            }
+
+            return check->WindowSpent < check->policy.BudgetNs;
+        }
+
+        case STACK_CHECK_ALWAYS:
+        default:
+            return true;
+    }
+}
+
+uint64_t CheckClock(clockid_t clock)
+{
+    struct timespec ts = {};
+
+    clock_gettime(clock, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// An error raised by an operation on a stack goes to the calling thread's err, as
+// everywhere else, and is also or-ed into the stack's own codes, which any thread
+// can read. Only failure paths get here, so the atomic costs nothing on success.
+
+void StackRaise(StackId_t StackId, uint64_t code)
+{
+    err |= code;
+
+    StackNoteErr(RegistryGet(StackId), code);
+}
+
+void StackNoteErr(StackSlot_t* slot, uint64_t codes)
+{
+    if (slot && codes)
+    {
+        __atomic_fetch_or(&(slot->errors), codes, __ATOMIC_RELAXED);
+    }
+}
+
+// Stats of a locked stack have one writer, the lock holder, so a relaxed load and
+// store is enough and keeps the lock prefix off push/pop. The lock-free paths and
+// the elimination array share the counters and add atomically.
+
+void StatAdd(uint64_t* counter, uint64_t value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+void StatAddShared(uint64_t* counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+// pushes/pops of the lock holder: with an elimination array the threads that
+// missed the lock count their exchanges into the same counters.
+
+void StatAddOp(const StackSlot_t* slot, uint64_t* counter, uint64_t value)
+{
+    if (slot->elimination)
+    {
+        StatAddShared(counter, value);
+    }
+    else
+    {
+        StatAdd(counter, value);
+    }
+}
+
+void StatPeak(uint64_t* peak, uint64_t size)
+{
+    if (size > __atomic_load_n(peak, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(peak, size, __ATOMIC_RELAXED);
+    }
+}
+
+void StatsAccumulate(StackStats_t* total, const StackStats_t* stats)
+{
+    StatAddShared(&(total->pushes),     __atomic_load_n(&(stats->pushes),     __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->pops),       __atomic_load_n(&(stats->pops),       __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->underflows), __atomic_load_n(&(stats->underflows), __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->grows),      __atomic_load_n(&(stats->grows),      __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->shrinks),    __atomic_load_n(&(stats->shrinks),    __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->BytesMoved), __atomic_load_n(&(stats->BytesMoved), __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->LockWaits),  __atomic_load_n(&(stats->LockWaits),  __ATOMIC_RELAXED));
+
+    StatAddShared(&(total->LockWaitNs), __atomic_load_n(&(stats->LockWaitNs), __ATOMIC_RELAXED));
+
+    uint64_t peak    = __atomic_load_n(&(stats->PeakSize), __ATOMIC_RELAXED);
+
+    uint64_t current = __atomic_load_n(&(total->PeakSize), __ATOMIC_RELAXED);
+
+    while (peak > current &&
+           !__atomic_compare_exchange_n(&(total->PeakSize), &current, peak, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#ifdef THREAD_PROTECTION
+
+void StackLock(StackSlot_t* slot)
+{
+    if (pthread_mutex_trylock(&(slot->mutex)) != 0)
+    {
+        StackLockWait(slot);
+    }
+}
+
+// Only the contended lock is timed: an uncontended push pays for the trylock it
+// already made and nothing else.
+
+void StackLockWait(StackSlot_t* slot)
+{
+    uint64_t start = CheckClock(CLOCK_MONOTONIC);
+
+    pthread_mutex_lock(&(slot->mutex));
+
+    StatAdd(&(slot->stats.LockWaits),  1);
+
+    StatAdd(&(slot->stats.LockWaitNs), CheckClock(CLOCK_MONOTONIC) - start);
+}
+
+#endif
+
+StackReturnCode StackVerify(StackId_t StackId, int line, const char* file, const char* function)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return STACK_DAMAGED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    slot->check.pending = false;
+
+    Stack_t* stack = GetStack(StackId);
+
+    STACK_ASSERT(STACK_IS_VALID(StackId));
+
+    if (StackIsDamaged(StackId, line, file, function) == STACK_DAMAGED)
     {
-        err += INVALID_HASH;
+        return STACK_DAMAGED;
+    }
 
+    if (stack->segments && SegmentedVerify(stack->segments) == FAILED)
+    {
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
         return STACK_DAMAGED;
     }
 
+    #ifdef HASH_PROTECTION
+
+    uint64_t DataHash = stack->DataHash;
+
+    CountDataHash(StackId);
+
     if (DataHash != stack->DataHash)
     {
-        err += INVALID_HASH;
+        StackRaise(StackId, INVALID_HASH);
 
         ON_DEBUG(StackDump(stack, line, file, function));
 
-        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(stack->mutex)));
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
         StackDtor(StackId);
 
@@ -907,11 +3026,71 @@ StackReturnCode StackIsDamaged(StackId_t StackId, int line, const char* file, co
 
     #endif
 
-    ON_DEBUG(StackDump(stack, line, file, function));
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(StackMutex(StackId)));
 
-    #endif
+    return STACK_NOT_DAMAGED;
+}
 
-    #endif
+// Free slots below touched must still be POISON: a mismatch means something wrote
+// past the top of the stack. A lazily poisoned stack has its never-written slots
+// poisoned here, so they are covered by the next check until the stack grows.
+// Stacks that keep their elements outside data have nothing to check.
+
+StackReturnCode StackCheckPoison(StackId_t StackId)
+{
+    StackSlot_t* slot = RegistryGet(StackId);
+
+    if (!slot)
+    {
+        err |= INVALID_STACK_ID_ERR;
+
+        return STACK_DAMAGED;
+    }
+
+    if (slot->frozen) // it poisons the never-touched slots
+    {
+        StackRaise(StackId, STACK_FROZEN);
+
+        return FAILED;
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_lock(&(slot->mutex)));
+
+    Stack_t* stack = GetStack(StackId);
+
+    if (!stack || stack->mode != STACK_MODE_LOCKED || stack->segments)
+    {
+        ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+        return stack ? STACK_NOT_DAMAGED : STACK_DAMAGED;
+    }
+
+    STACK_ASSERT(STACK_IS_VALID(StackId));
+
+    for (uint64_t i = stack->size; i < stack->touched; i++)
+    {
+        if (stack->data[i] != POISON)
+        {
+            StackRaise(StackId, INVALID_POISON);
+
+            ON_DEBUG(StackDump(stack, __LINE__, __FILE__, __PRETTY_FUNCTION__));
+
+            ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
+
+            return STACK_DAMAGED;
+        }
+    }
+
+    if (stack->touched < stack->capacity)
+    {
+        memset((void*) (stack->data + stack->touched), POISON, (stack->capacity - stack->touched) * sizeof(StackElem_t));
+
+        stack->touched = stack->capacity;
+
+        ON_HASH_PROTECTION(CountStructHash(StackId));
+    }
+
+    ON_THREAD_PROTECTION(pthread_mutex_unlock(&(slot->mutex)));
 
     return STACK_NOT_DAMAGED;
 }
@@ -938,6 +3117,10 @@ StackReturnCode PrintErr(FILE* fp, uint64_t code)
 
     ON_LOG(fprintf(fp, "ERRORS: "));
 
+    PRINT_ERR(code, 32768, "INVALID POISON ");
+
+    PRINT_ERR(code, 16384, "STACK FROZEN ");
+
     PRINT_ERR(code, 8192, "INVALID STACK ID ");
 
     PRINT_ERR(code, 4096, "INVALID STRUCT CANARY ");
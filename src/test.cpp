@@ -2,8 +2,28 @@
 #include <stdlib.h>
 #include <time.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "stack.h"
+#include "stack.hpp"
+#include "allocation.h"
+#include "hash.h"
+
+const StackElem_t PTHR_OPS      = 100;
+
+const StackElem_t STEAL_OPS     = 10000;
+
+const int         STEAL_THIEVES = 3;
+
+struct StealArgs_t
+{
+    const StackId_t* ids;
+    int              thief;
+    StackElem_t      sum;
+    uint64_t         count;
+};
+
+static bool StealRunning = false;
 
 StackReturnCode StackTest();
 
@@ -11,24 +31,41 @@ void* PthrPush(void* args);
 
 void* PthrDel(void* args);
 
+void* PthrSteal(void* args);
+
 StackReturnCode StackTest()
 {
     StackId_t StackId = STACK_CTOR(MIN_STACK_SIZE);
 
-//     pthread_t threads[2];
+    pthread_t threads[2];
+
+    pthread_create(&threads[0], NULL, PthrPush, &StackId);
+    pthread_create(&threads[1], NULL, PthrDel,  &StackId);
+
+    void* PoppedSum = nullptr;
 
-//     pthread_create(&threads[0], NULL, PthrPush,  &StackId);
-//     pthread_create(&threads[1], NULL, PthrDel,   &StackId);
-//
-//     pthread_join(threads[0], NULL);
-//     pthread_join(threads[1], NULL);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], &PoppedSum);
 
+    StackElem_t sum = (StackElem_t) PoppedSum;
+
+    for (StackElem_t i = 1; i <= PTHR_OPS; i++)
+    {
+        sum += StackPop(StackId);
+    }
+
+    if (sum != PTHR_OPS * (2 * PTHR_OPS + 1))
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
 
     FILE* UnitTestFile = fopen("unit_test", "wb");
 
     if (!UnitTestFile)
     {
-        err += INVALID_FILE_POINTER;
+        err |= INVALID_FILE_POINTER;
 
         return FAILED;
     }
@@ -46,40 +83,446 @@ StackReturnCode StackTest()
         r = rand() % 100;
     }
 
+    if (STACK_VERIFY(StackId) == STACK_DAMAGED)
+    {
+        return FAILED;
+    }
+
     for (size_t i = 32; i > 0; i--)
     {
         StackPop(StackId);
     }
 
+    StackElem_t batch[32]  = {};
+
+    StackElem_t popped[32] = {};
+
+    for (size_t i = 0; i < 32; i++)
+    {
+        batch[i] = (StackElem_t) (rand() % 100);
+    }
+
+    StackPushN(StackId, batch, 32);
+
+    StackPopN( StackId, popped, 32);
+
+    for (size_t i = 0; i < 32; i++)
+    {
+        if (batch[i] != popped[i])
+        {
+            err |= DAMAGED_STACK_ERR;
+
+            return FAILED;
+        }
+    }
+
+    StackResizeCounters_t counters = {};
+
+    StackReserve(StackId, 64);
+
+    StackPushN(StackId, batch, 32);
+
+    StackPopN( StackId, popped, 32);
+
+    StackGetResizeCounters(StackId, &counters);
+
+    uint64_t grows = counters.grows;
+
+    StackShrinkToFit(StackId);
+
+    StackGetResizeCounters(StackId, &counters);
+
+    if (counters.grows != grows || counters.shrinks == 0)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
     StackDtor(StackId) verified;
 
+    StackOptions_t options = DEFAULT_STACK_OPTIONS;
+
+    options.check = {STACK_CHECK_EVERY_N, 4};
+
+    StackId_t SampledId = STACK_CTOR_EX(MIN_STACK_SIZE, &options);
+
+    for (size_t i = 0; i < 32; i++)
+    {
+        StackPush(SampledId, batch[i]);
+    }
+
+    StackCheckCounters_t checks = {};
+
+    StackGetCheckCounters(SampledId, &checks);
+
+    if (checks.checked != 8 || checks.skipped != 24)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    StackStats_t stats = {};
+
+    StackGetStats(SampledId, &stats);
+
+    if (stats.pushes != 32 || stats.pops != 0 || stats.PeakSize != 32 || stats.grows == 0)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    if (StackScrubAll() == STACK_DAMAGED)
+    {
+        return FAILED;
+    }
+
+    uint64_t codes = StackClearErr();
+
+    StackPopN(SampledId, popped, 33);
+
+    if (StackClearErr() != STACK_UNDERFLOW || StackClearStackErr(SampledId) != STACK_UNDERFLOW)
+    {
+        err = codes | DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    err = codes;
+
+    StackDtor(SampledId) verified;
+
+    AllocStats_t before = {};
+
+    alloc_trace_stats(&before);
+
+    options = DEFAULT_STACK_OPTIONS;
+
+    options.storage = STACK_STORAGE_SEGMENTED;
+
+    StackId_t SegmentedId = STACK_CTOR_EX(MIN_STACK_SIZE, &options);
+
+    StackPushN(SegmentedId, batch, 32);
+
+    StackId_t SnapshotId = STACK_SNAPSHOT(SegmentedId);
+
+    StackPop( SegmentedId);
+
+    StackPush(SegmentedId, 0);
+
+    codes = StackClearErr();
+
+    if (StackPush(SnapshotId, 0) != FAILED || StackClearErr() != STACK_FROZEN)
+    {
+        err = codes | DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    err = codes;
+
+    StackId_t CloneId = STACK_CLONE(SnapshotId);
+
+    if (StackPopN(CloneId, popped, 32) != EXECUTED || popped[31] != batch[31])
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    StackDtor(CloneId)     verified;
+
+    StackDtor(SnapshotId)  verified;
+
+    StackDtor(SegmentedId) verified;
+
+    AllocStats_t after = {};
+
+    alloc_trace_stats(&after);
+
+    if (after.allocs == before.allocs || after.LiveBytes != before.LiveBytes || after.LiveBlocks != before.LiveBlocks)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    options = DEFAULT_STACK_OPTIONS;
+
+    options.storage = STACK_STORAGE_FILE;
+
+    options.path    = "stack.bin";
+
+    StackId_t FileId = STACK_CTOR_EX(MIN_STACK_SIZE, &options);
+
+    StackPushN(FileId, batch, 32);
+
+    StackDtor(FileId) verified;
+
+    FileId = STACK_OPEN(options.path);
+
+    codes = StackClearErr();
+
+    if (STACK_OPEN(options.path) != INVALID_STACK_ID || STACK_CTOR_EX(MIN_STACK_SIZE, &options) != INVALID_STACK_ID)
+    {
+        err = codes | DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    err = codes;
+
+    if (StackPopN(FileId, popped, 32) != EXECUTED || popped[31] != batch[31] || STACK_VERIFY(FileId) != STACK_NOT_DAMAGED)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    StackDtor(FileId) verified;
+
+    unlink(options.path);
+
+    fflush(UnitTestFile);
+
+    options.path = "unit_test"; // not a stack file, must be left as it is
+
+    codes = StackClearErr();
+
+    if (STACK_CTOR_EX(MIN_STACK_SIZE, &options) != INVALID_STACK_ID || !(StackGetErr() & INVALID_FILE_POINTER) ||
+        fseek(UnitTestFile, 0, SEEK_END) != 0 || ftell(UnitTestFile) <= 0)
+    {
+        err = codes | DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    err = codes;
+
+    options = DEFAULT_STACK_OPTIONS;
+
+    options.LazyPoison = true;
+
+    StackId_t LazyId = STACK_CTOR_EX(1024, &options);
+
+    StackPushN(LazyId, batch, 32);
+
+    StackPopN(LazyId, popped, 16);
+
+    if (StackCheckPoison(LazyId) != STACK_NOT_DAMAGED || StackPopN(LazyId, popped, 16) != EXECUTED ||
+        popped[15] != batch[15] || StackCheckPoison(LazyId) != STACK_NOT_DAMAGED)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    StackDtor(LazyId) verified;
+
+    // Work-stealing group: this thread owns group[0] and pushes 1..STEAL_OPS,
+    // popping every third one back, while the thieves steal from the whole group.
+    // Every value must come out exactly once.
+
+    StackId_t group[STEAL_THIEVES + 1] = {};
+
+    STACK_GROUP_CTOR(group, STEAL_THIEVES + 1, MIN_STACK_SIZE) verified;
+
+    StealArgs_t thieves[STEAL_THIEVES]  = {};
+
+    pthread_t   handles[STEAL_THIEVES]  = {};
+
+    __atomic_store_n(&StealRunning, true, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < STEAL_THIEVES; i++)
+    {
+        thieves[i] = {group, i + 1, 0, 0};
+
+        pthread_create(&handles[i], NULL, PthrSteal, &thieves[i]);
+    }
+
+    StackElem_t StealSum   = 0;
+
+    uint64_t    StealCount = 0;
+
+    codes = StackClearErr(); // underflows of the owner when the thieves got there first
+
+    for (StackElem_t i = 1; i <= STEAL_OPS; i++)
+    {
+        StackPush(group[0], i);
+
+        StackElem_t value = i % 3 == 0 ? StackPop(group[0]) : FAILED;
+
+        if (value != FAILED) // FAILED: a thief took the rest
+        {
+            StealSum += value;
+
+            StealCount++;
+        }
+    }
+
+    __atomic_store_n(&StealRunning, false, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < STEAL_THIEVES; i++)
+    {
+        pthread_join(handles[i], NULL);
+
+        StealSum   += thieves[i].sum;
+
+        StealCount += thieves[i].count;
+    }
+
+    for (StackElem_t value = StackPop(group[0]); value != FAILED; value = StackPop(group[0]))
+    {
+        StealSum += value;
+
+        StealCount++;
+    }
+
+    err = codes;
+
+    StackGroupDtor(group, STEAL_THIEVES + 1) verified;
+
+    if (StealCount != (uint64_t) STEAL_OPS || StealSum != STEAL_OPS * (STEAL_OPS + 1) / 2)
+    {
+        err |= DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    // Every hash kernel this CPU has must agree with the scalar one from any
+    // starting element or byte and for lengths that leave a tail, and CRC32C
+    // must give its check value for "123456789".
+
+    StackElem_t   HashElems[72] = {};
+
+    unsigned char HashBytes[72] = {};
+
+    for (size_t i = 0; i < 72; i++)
+    {
+        HashElems[i] = (StackElem_t) rand() << 16 ^ rand();
+
+        HashBytes[i] = (unsigned char) rand();
+    }
+
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        for (size_t count = 0; count + offset <= 72; count++)
+        {
+            if (HashCheckKernels(HashElems + offset, count, offset * 5, HashBytes + offset, count) != EXECUTED)
+            {
+                err |= INVALID_HASH;
+
+                return FAILED;
+            }
+        }
+    }
+
+    if ((StructBlockHash(0xFFFFFFFF, "123456789", 9) ^ 0xFFFFFFFF) != 0xE3069283)
+    {
+        err |= INVALID_HASH;
+
+        return FAILED;
+    }
+
+    codes = StackClearErr();
+
+    Stack<StackElem_t, CheckedStackPolicy_t> oversized((size_t) MAX_MAPPED_STACK_SIZE + 1);
+
+    if (oversized.Push(batch[0]) != FAILED || oversized.Pop(&popped[0]) != FAILED || oversized.Verify() != FAILED)
+    {
+        err = codes | DAMAGED_STACK_ERR;
+
+        return FAILED;
+    }
+
+    err = codes;
+
+    Stack<StackElem_t, CheckedStackPolicy_t> typed;
+
+    for (size_t i = 0; i < 32; i++)
+    {
+        typed.Push(batch[i]);
+    }
+
+    for (size_t i = 32; i > 0; i--)
+    {
+        if (typed.Pop(&popped[i - 1]) != EXECUTED || popped[i - 1] != batch[i - 1])
+        {
+            err |= DAMAGED_STACK_ERR;
+
+            return FAILED;
+        }
+    }
+
+    if (typed.Verify() == STACK_DAMAGED)
+    {
+        return FAILED;
+    }
+
     return EXECUTED;
 }
 
-// void* PthrPush(void* args)
-// {
-//     StackId_t id = *((StackId_t*) args);
-//
-//     StackPush(id, 1);
-//     StackPush(id, 2);
-//     StackPush(id, 3);
-//     StackPush(id, 4);
-//     StackPush(id, 5);
-//
-//     pthread_exit(NULL);
-// }
-//
-// void* PthrDel(void* args)
-// {
-//     StackId_t id = *((StackId_t*) args);
-//
-//     // *((StackElem_t*)((char*) STACKS[id - 1]->data + 3*sizeof(StackElem_t))) = 0;;
-//
-//     StackPush(id, 6);
-//     StackPush(id, 7);
-//     StackPush(id, 8);
-//     StackPush(id, 9);
-//     StackPush(id, 10);
-//
-//     pthread_exit(NULL);
-// }
+// Together they push 1..2 * PTHR_OPS and pop PTHR_OPS of them; PthrDel pops only
+// after its own pushes, so it never finds the stack empty, and returns the sum of
+// what it popped.
+
+void* PthrPush(void* args)
+{
+    StackId_t id = *((StackId_t*) args);
+
+    for (StackElem_t i = 1; i <= PTHR_OPS; i++)
+    {
+        StackPush(id, i);
+    }
+
+    pthread_exit(NULL);
+}
+
+void* PthrDel(void* args)
+{
+    StackId_t id = *((StackId_t*) args);
+
+    for (StackElem_t i = 1; i <= PTHR_OPS; i++)
+    {
+        StackPush(id, PTHR_OPS + i);
+    }
+
+    StackElem_t sum = 0;
+
+    for (StackElem_t i = 1; i <= PTHR_OPS; i++)
+    {
+        sum += StackPop(id);
+    }
+
+    pthread_exit((void*) sum);
+}
+
+// Steals from the other stacks of the group until the owner is done and nothing
+// is left to take.
+
+void* PthrSteal(void* args)
+{
+    StealArgs_t* thief = (StealArgs_t*) args;
+
+    StackElem_t value = 0;
+
+    while (true)
+    {
+        bool running = __atomic_load_n(&StealRunning, __ATOMIC_ACQUIRE);
+
+        if (StackGroupSteal(thief->ids, STEAL_THIEVES + 1, thief->thief, &value) == EXECUTED)
+        {
+            thief->sum += value;
+
+            thief->count++;
+        }
+        else if (!running)
+        {
+            break;
+        }
+    }
+
+    pthread_exit(NULL);
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stack.h"
+#include "worksteal.h"
+#include "allocation.h"
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+//
+// The owner pushes and pops at bottom like an ordinary stack, thieves take the
+// oldest element at top. The buffer is a circular StackElem_t array that doubles
+// like StackResize does; a replaced buffer may still be read by a thief, so it is
+// kept on the retired list and only freed in WorkStealDtor.
+//
+// This deliberately does not reuse Stack_t's data block and StackResize, as
+// locked stacks do: top and bottom only ever grow and index the buffer modulo
+// its capacity, and a thief may still be reading the old block after a resize,
+// which a block StackResize reallocs in place cannot allow. The deque therefore
+// keeps its own buffer and Stack_t::data stays unused in this mode.
+
+struct WorkStealBuffer_t
+{
+    uint64_t           capacity;
+    WorkStealBuffer_t* retired;
+    StackElem_t*       data;
+};
+
+struct WorkStealDeque_t
+{
+    alignas(CACHE_LINE_SIZE) int64_t            top;
+    alignas(CACHE_LINE_SIZE) int64_t            bottom;
+                             WorkStealBuffer_t* buffer;
+                             FILE*              MemoryLogFile;
+};
+
+static WorkStealBuffer_t* BufferCtor         (WorkStealDeque_t* deque, uint64_t capacity);
+
+static WorkStealBuffer_t* BufferGrow         (WorkStealDeque_t* deque, WorkStealBuffer_t* buffer,
+                                              int64_t top, int64_t bottom);
+
+WorkStealDeque_t* WorkStealCtor(uint64_t capacity, FILE* MemoryLogFile)
+{
+    WorkStealDeque_t* deque = (WorkStealDeque_t*) log_aligned_calloc(MemoryLogFile, CACHE_LINE_SIZE, sizeof(WorkStealDeque_t));
+
+    if (!deque)
+    {
+        err |= INVALID_STACK_POINTER;
+
+        return nullptr;
+    }
+
+    deque->MemoryLogFile = MemoryLogFile;
+
+    deque->buffer = BufferCtor(deque, capacity < MIN_STACK_SIZE ? MIN_STACK_SIZE : capacity);
+
+    if (!deque->buffer)
+    {
+        log_aligned_free(MemoryLogFile, deque);
+
+        return nullptr;
+    }
+
+    return deque;
+}
+
+StackReturnCode WorkStealPush(WorkStealDeque_t* deque, StackElem_t value)
+{
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+
+    int64_t top    = __atomic_load_n(&deque->top,    __ATOMIC_ACQUIRE);
+
+    WorkStealBuffer_t* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_RELAXED);
+
+    if (bottom - top > (int64_t) buffer->capacity - 1)
+    {
+        buffer = BufferGrow(deque, buffer, top, bottom);
+
+        if (!buffer)
+        {
+            return FAILED;
+        }
+    }
+
+    __atomic_store_n(&buffer->data[(uint64_t) bottom % buffer->capacity], value, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+    return EXECUTED;
+}
+
+StackReturnCode WorkStealPop(WorkStealDeque_t* deque, StackElem_t* value)
+{
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+
+    WorkStealBuffer_t* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom)
+    {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+        err |= STACK_UNDERFLOW;
+
+        return FAILED;
+    }
+
+    *value = __atomic_load_n(&buffer->data[(uint64_t) bottom % buffer->capacity], __ATOMIC_RELAXED);
+
+    if (top == bottom) // last element, race against thieves for it
+    {
+        bool won = __atomic_compare_exchange_n(&deque->top, &top, top + 1,
+                                               false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+        if (!won)
+        {
+            err |= STACK_UNDERFLOW;
+
+            return FAILED;
+        }
+    }
+
+    return EXECUTED;
+}
+
+StackReturnCode WorkStealSteal(WorkStealDeque_t* deque, StackElem_t* value)
+{
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom)
+    {
+        return FAILED;
+    }
+
+    WorkStealBuffer_t* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_ACQUIRE);
+
+    StackElem_t stolen = __atomic_load_n(&buffer->data[(uint64_t) top % buffer->capacity], __ATOMIC_RELAXED);
+
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1,
+                                     false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        return FAILED;
+    }
+
+    *value = stolen;
+
+    return EXECUTED;
+}
+
+StackReturnCode WorkStealDtor(WorkStealDeque_t* deque)
+{
+    if (!deque)
+    {
+        return FAILED;
+    }
+
+    WorkStealBuffer_t* buffer = deque->buffer;
+
+    while (buffer)
+    {
+        WorkStealBuffer_t* retired = buffer->retired;
+
+        log_free(deque->MemoryLogFile, buffer);
+
+        buffer = retired;
+    }
+
+    log_aligned_free(deque->MemoryLogFile, deque);
+
+    return EXECUTED;
+}
+
+WorkStealBuffer_t* BufferCtor(WorkStealDeque_t* deque, uint64_t capacity)
+{
+    WorkStealBuffer_t* buffer = (WorkStealBuffer_t*) log_calloc(deque->MemoryLogFile, 1,
+                                                                sizeof(WorkStealBuffer_t) +
+                                                                capacity * sizeof(StackElem_t));
+
+    if (!buffer)
+    {
+        err |= INVALID_DATA_POINTER;
+
+        return nullptr;
+    }
+
+    buffer->capacity = capacity;
+
+    buffer->data     = (StackElem_t*) (buffer + 1);
+
+    return buffer;
+}
+
+WorkStealBuffer_t* BufferGrow(WorkStealDeque_t* deque, WorkStealBuffer_t* buffer, int64_t top, int64_t bottom)
+{
+    if (buffer->capacity * 2 > MAX_STACK_SIZE)
+    {
+        err |= STACK_OVERFLOW;
+
+        return nullptr;
+    }
+
+    WorkStealBuffer_t* grown = BufferCtor(deque, buffer->capacity * 2);
+
+    if (!grown)
+    {
+        return nullptr;
+    }
+
+    for (int64_t i = top; i < bottom; i++)
+    {
+        grown->data[(uint64_t) i % grown->capacity] = buffer->data[(uint64_t) i % buffer->capacity];
+    }
+
+    grown->retired = buffer;
+
+    __atomic_store_n(&deque->buffer, grown, __ATOMIC_RELEASE);
+
+    return grown;
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stack.h"
+#include "dumper.h"
+
+// Renders a binary trace written by a BINARY_DUMP build into the dump.log
+// layout (built with FILE_LOG) or the dump.html layout (built with FILE_HTML).
+//
+//     trace2log  [-i stack id] [-p op] dump.trace [output]
+//     trace2html [-i stack id] [-p op] dump.trace [output]
+
+const int TRACE_NAMES_SIZE = 4096;
+
+struct TraceName_t
+{
+    uint64_t key;
+    char*    string;
+};
+
+static TraceName_t TraceNames[TRACE_NAMES_SIZE] = {};
+
+static const char* const OP_NAMES[] = {"other", "ctor", "dtor", "push", "pop", "resize", "verify"};
+
+static StackReturnCode   RenderTrace         (FILE* input, FILE* output, StackId_t id, int op);
+
+static StackReturnCode   NameSet             (uint64_t key, char* string);
+
+static const char*       NameGet             (uint64_t key);
+
+static int               ParseOp             (const char* name);
+
+int main(int argc, char* argv[])
+{
+    StackId_t id = INVALID_STACK_ID;
+
+    int       op = -1;
+
+    int       option = 0;
+
+    while ((option = getopt(argc, argv, "i:p:")) != -1)
+    {
+        switch (option)
+        {
+            case 'i':
+                id = strtoll(optarg, nullptr, 10);
+                break;
+
+            case 'p':
+                op = ParseOp(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-i stack id] [-p op] trace [output]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || op == -2)
+    {
+        fprintf(stderr, "usage: %s [-i stack id] [-p op] trace [output]\n", argv[0]);
+
+        return 1;
+    }
+
+    FILE* input = fopen(argv[optind], "rb");
+
+    if (!input)
+    {
+        fprintf(stderr, "can't open %s\n", argv[optind]);
+
+        return 1;
+    }
+
+    FILE* output = optind + 1 < argc ? fopen(argv[optind + 1], "w") : stdout;
+
+    if (!output)
+    {
+        fprintf(stderr, "can't open %s\n", argv[optind + 1]);
+
+        fclose(input);
+
+        return 1;
+    }
+
+    StackReturnCode code = RenderTrace(input, output, id, op);
+
+    fclose(input);
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+
+    for (int i = 0; i < TRACE_NAMES_SIZE; i++)
+    {
+        free(TraceNames[i].string);
+    }
+
+    return code == EXECUTED ? 0 : 1;
+}
+
+StackReturnCode RenderTrace(FILE* input, FILE* output, StackId_t id, int op)
+{
+    TraceHeader_t header = {};
+
+    if (fread(&header, sizeof(header), 1, input) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "not a stack trace file\n");
+
+        return FAILED;
+    }
+
+    if (header.version != TRACE_VERSION || header.RecordSize != sizeof(TraceRecord_t))
+    {
+        fprintf(stderr, "unsupported trace version %u (record size %u)\n", header.version, header.RecordSize);
+
+        return FAILED;
+    }
+
+    ON_HTML(fprintf(output, "<!DOCTYPE html><html>"));
+
+    TraceRecord_t trace = {};
+
+    StackElem_t* data = nullptr;
+
+    StackReturnCode code = EXECUTED;
+
+    while (fread(&trace, sizeof(trace), 1, input) == 1)
+    {
+        char* payload = (char*) calloc(trace.payload + 1, 1);
+
+        if (!payload || fread(payload, 1, trace.payload, input) != trace.payload)
+        {
+            fprintf(stderr, "truncated trace\n");
+
+            free(payload);
+
+            code = FAILED;
+
+            break;
+        }
+
+        if (trace.kind == TRACE_STRING)
+        {
+            NameSet(trace.address, payload);
+
+            continue;
+        }
+
+        if (trace.kind != TRACE_DUMP                 ||
+            (id != INVALID_STACK_ID && trace.id != id) ||
+            (op != -1 && trace.op != (uint32_t) op))
+        {
+            free(payload);
+
+            continue;
+        }
+
+        DumpRecord_t record = {};
+
+        record.timestamp       = trace.timestamp;
+        record.err             = trace.err;
+        record.address         = (const void*) trace.address;
+        record.name            = NameGet(trace.name);
+        record.file            = NameGet(trace.file);
+        record.line            = trace.line;
+        record.function        = NameGet(trace.function);
+        record.BornFile        = NameGet(trace.BornFile);
+        record.BornLine        = trace.BornLine;
+        record.BornFunc        = NameGet(trace.BornFunc);
+        record.id              = trace.id;
+        record.LeftCanary      = trace.LeftCanary;
+        record.RightCanary     = trace.RightCanary;
+        record.DataLeftCanary  = trace.DataLeftCanary;
+        record.DataRightCanary = trace.DataRightCanary;
+        record.StructHash      = trace.StructHash;
+        record.DataHash        = trace.DataHash;
+        record.capacity        = trace.capacity;
+        record.size            = trace.size;
+        record.touched         = trace.capacity;
+        record.LostStack       = trace.flags & TRACE_LOST_STACK;
+        record.LostData        = trace.flags & TRACE_LOST_DATA;
+        record.ElemsFirst      = trace.ElemsFirst;
+
+        uint64_t count = trace.payload / sizeof(StackElem_t);
+
+        data = nullptr;
+
+        if (trace.flags & TRACE_WRITTEN_ELEMS)
+        {
+            data = (StackElem_t*) payload;
+
+            record.touched = count;
+        }
+        else
+        {
+            record.ElemsCount = count < DUMP_RECORD_ELEMS ? count : DUMP_RECORD_ELEMS;
+
+            memcpy(record.elems, payload, record.ElemsCount * sizeof(StackElem_t));
+        }
+
+        DumpWrite(output, &record, data);
+
+        free(payload);
+    }
+
+    ON_HTML(fprintf(output, "</html>\n"));
+
+    return code;
+}
+
+StackReturnCode NameSet(uint64_t key, char* string)
+{
+    uint64_t slot = (key >> 3) % TRACE_NAMES_SIZE;
+
+    for (int probe = 0; probe < TRACE_NAMES_SIZE; probe++)
+    {
+        TraceName_t* name = &TraceNames[(slot + (uint64_t) probe) % TRACE_NAMES_SIZE];
+
+        if (name->key == key || !name->string)
+        {
+            free(name->string);
+
+            name->key    = key;
+
+            name->string = string;
+
+            return EXECUTED;
+        }
+    }
+
+    free(string);
+
+    return FAILED;
+}
+
+const char* NameGet(uint64_t key)
+{
+    if (!key)
+    {
+        return "(null)";
+    }
+
+    uint64_t slot = (key >> 3) % TRACE_NAMES_SIZE;
+
+    for (int probe = 0; probe < TRACE_NAMES_SIZE; probe++)
+    {
+        TraceName_t* name = &TraceNames[(slot + (uint64_t) probe) % TRACE_NAMES_SIZE];
+
+        if (!name->string)
+        {
+            break;
+        }
+
+        if (name->key == key)
+        {
+            return name->string;
+        }
+    }
+
+    return "(unknown)";
+}
+
+int ParseOp(const char* name)
+{
+    for (size_t i = 0; i < sizeof(OP_NAMES) / sizeof(OP_NAMES[0]); i++)
+    {
+        if (strcmp(name, OP_NAMES[i]) == 0)
+        {
+            return (int) i;
+        }
+    }
+
+    fprintf(stderr, "unknown op %s\n", name);
+
+    return -2;
+}